@@ -6,6 +6,16 @@
 #ifndef LOADER_PARAMS_H
 #define LOADER_PARAMS_H
 
+///
+/// Indices into LOADER_PARAMS.BootTsc, in the order they are taken.
+///
+#define LOADER_TSC_ENTRY     0  ///< UefiMain entry
+#define LOADER_TSC_HEADER    1  ///< Kernel ELF header read
+#define LOADER_TSC_SECTIONS  2  ///< Debug sections read
+#define LOADER_TSC_SEGMENTS  3  ///< Loadable segments read
+#define LOADER_TSC_EXIT      4  ///< Boot services exited, jumping to the kernel
+#define LOADER_TSC_COUNT     5
+
 typedef struct {
   ///
   /// Virtual pointer to self.
@@ -52,6 +62,11 @@ typedef struct {
   EFI_PHYSICAL_ADDRESS     DebugPubnamesEnd;
   EFI_PHYSICAL_ADDRESS     DebugPubtypesStart;
   EFI_PHYSICAL_ADDRESS     DebugPubtypesEnd;
+
+  ///
+  /// Boot timing: TSC values taken by the loader, zero if not reached.
+  ///
+  UINT64                   BootTsc[LOADER_TSC_COUNT];
 } LOADER_PARAMS;
 
 #endif // LOADER_PARAMS_H
@@ -7,6 +7,7 @@
 #include <Library/UefiApplicationEntryPoint.h>
 #include <Library/DebugLib.h>
 #include "Bootloader.h"
+#include "Lz4.h"
 #include "VirtualMemory.h"
 
 VOID *
@@ -271,13 +272,15 @@ AcpiFindRsdp (
   Obtain kernel file protocol.
 
   @param[out] FileProtocol  Instance of file protocol holding the kernel.
+  @param[out] FastBoot      Whether the fast boot marker file exists.
 
   @retval EFI_SUCCESS on success.
 **/
 STATIC
 EFI_STATUS
 GetKernelFile (
-  OUT  EFI_FILE_PROTOCOL  **FileProtocol
+  OUT  EFI_FILE_PROTOCOL  **FileProtocol,
+  OUT  BOOLEAN            *FastBoot
   )
 {
   EFI_STATUS                       Status;
@@ -285,8 +288,10 @@ GetKernelFile (
   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL  *FileSystem;
   EFI_FILE_PROTOCOL                *CurrentDriveRoot;
   EFI_FILE_PROTOCOL                *KernelFile;
+  EFI_FILE_PROTOCOL                *MarkerFile;
 
   ASSERT (FileProtocol != NULL);
+  ASSERT (FastBoot != NULL);
 
   Status = gBS->HandleProtocol (
     gImageHandle,
@@ -330,6 +335,14 @@ GetKernelFile (
     0
     );
 
+  *FastBoot = FALSE;
+  if (!EFI_ERROR (Status)) {
+    if (!EFI_ERROR (CurrentDriveRoot->Open (CurrentDriveRoot, &MarkerFile, FASTBOOT_PATH, EFI_FILE_MODE_READ, 0))) {
+      MarkerFile->Close (MarkerFile);
+      *FastBoot = TRUE;
+    }
+  }
+
   CurrentDriveRoot->Close (CurrentDriveRoot);
 
   if (EFI_ERROR (Status)) {
@@ -341,6 +354,150 @@ GetKernelFile (
   return EFI_SUCCESS;
 }
 
+///
+/// Kernel file contents when read in one piece, NULL otherwise.
+///
+STATIC UINT8  *mKernelImage;
+STATIC UINTN  mKernelImageSize;
+
+/**
+  Replace an LZ4-compressed image buffer by its decompressed contents.
+
+  @param[in, out] Image      Image buffer, freed and replaced on success.
+  @param[in, out] ImageSize  Image size.
+
+  @retval EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+DecompressKernelImage (
+  IN OUT UINT8  **Image,
+  IN OUT UINTN  *ImageSize
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      ContentSize;
+  UINT8       *Data;
+
+  Status = Lz4FrameContentSize (*Image, *ImageSize, &ContentSize);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "JOS: Compressed kernel has no content size - %r\n", Status));
+    return Status;
+  }
+
+  if (ContentSize > MAX_UINTN) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  Data = AllocatePool ((UINTN) ContentSize);
+  if (Data == NULL) {
+    DEBUG ((DEBUG_ERROR, "JOS: Failed to allocate %Lu bytes for kernel\n", ContentSize));
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = Lz4DecompressFrame (*Image, *ImageSize, Data, (UINTN) ContentSize);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "JOS: Failed to decompress kernel - %r\n", Status));
+    FreePool (Data);
+    return Status;
+  }
+
+  DEBUG ((DEBUG_INFO, "JOS: Decompressed kernel from %u to %Lu bytes\n", (UINT32) *ImageSize, ContentSize));
+
+  FreePool (*Image);
+  *Image     = Data;
+  *ImageSize = (UINTN) ContentSize;
+  return EFI_SUCCESS;
+}
+
+/**
+  Read the whole kernel file into a pool buffer with a single
+  sequential read, decompressing it if it is an LZ4 frame. Later
+  CheckedReadData and CheckedReadString calls are served from this
+  buffer until FreeKernelImage.
+
+  @param[in]  File    File protocol instance.
+
+  @retval EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+ReadKernelImage (
+  IN  EFI_FILE_PROTOCOL  *File
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      FileSize;
+  UINTN       ReadSize;
+  UINT8       *Image;
+
+  ASSERT (File != NULL);
+
+  //
+  // Setting the position to all ones moves it to the end of file.
+  //
+  Status = File->SetPosition (File, MAX_UINT64);
+  if (!EFI_ERROR (Status)) {
+    Status = File->GetPosition (File, &FileSize);
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = File->SetPosition (File, 0);
+  }
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "JOS: Failed to get kernel file size - %r\n", Status));
+    return Status;
+  }
+
+  if (FileSize > MAX_UINTN) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  Image = AllocatePool ((UINTN) FileSize);
+  if (Image == NULL) {
+    DEBUG ((DEBUG_ERROR, "JOS: Failed to allocate %Lu bytes for kernel file\n", FileSize));
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ReadSize = (UINTN) FileSize;
+  Status = File->Read (File, &ReadSize, Image);
+  if (!EFI_ERROR (Status) && ReadSize != FileSize) {
+    Status = EFI_DEVICE_ERROR;
+  }
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "JOS: Failed to read %Lu-byte kernel file - %r\n", FileSize, Status));
+    FreePool (Image);
+    return Status;
+  }
+
+  if (Lz4IsFrame (Image, ReadSize)) {
+    Status = DecompressKernelImage (&Image, &ReadSize);
+    if (EFI_ERROR (Status)) {
+      FreePool (Image);
+      return Status;
+    }
+  }
+
+  mKernelImage     = Image;
+  mKernelImageSize = ReadSize;
+  return EFI_SUCCESS;
+}
+
+/**
+  Release the buffer allocated by ReadKernelImage, if any.
+**/
+STATIC
+VOID
+FreeKernelImage (
+  VOID
+  )
+{
+  if (mKernelImage != NULL) {
+    FreePool (mKernelImage);
+    mKernelImage     = NULL;
+    mKernelImageSize = 0;
+  }
+}
+
 /**
   Read file data at offset of specified size.
 
@@ -366,6 +523,22 @@ CheckedReadData (
   ASSERT (File != NULL);
   ASSERT (Data != NULL);
 
+  if (mKernelImage != NULL) {
+    if (Offset > mKernelImageSize || Size > mKernelImageSize - Offset) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "JOS: Failed to read %u bytes at %u past the end of %u-byte file\n",
+        (UINT32) Size,
+        (UINT32) Offset,
+        (UINT32) mKernelImageSize
+        ));
+      return EFI_DEVICE_ERROR;
+    }
+
+    CopyMem (Data, mKernelImage + Offset, Size);
+    return EFI_SUCCESS;
+  }
+
   Status = File->SetPosition (File, Offset);
   if (EFI_ERROR (Status)) {
     DEBUG ((
@@ -430,6 +603,23 @@ CheckedReadString (
   ASSERT (Size > 1);
   ASSERT (String != NULL);
 
+  if (mKernelImage != NULL) {
+    if (Offset > mKernelImageSize) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "JOS: Failed to read string at %u past the end of %u-byte file\n",
+        (UINT32) Offset,
+        (UINT32) mKernelImageSize
+        ));
+      return EFI_DEVICE_ERROR;
+    }
+
+    ReadSize = MIN (Size - 1, mKernelImageSize - Offset);
+    CopyMem (String, mKernelImage + Offset, ReadSize);
+    String[ReadSize] = '\0';
+    return EFI_SUCCESS;
+  }
+
   Status = File->SetPosition (File, Offset);
   if (EFI_ERROR (Status)) {
     DEBUG ((
@@ -487,6 +677,7 @@ LoadKernel (
   EFI_PHYSICAL_ADDRESS  MinAddress;
   EFI_PHYSICAL_ADDRESS  MaxAddress;
   EFI_PHYSICAL_ADDRESS  KernelSize;
+  BOOLEAN               FastBoot;
 
   ASSERT (LoaderParams != NULL);
   ASSERT (EntryPoint != NULL);
@@ -495,7 +686,7 @@ LoadKernel (
   // Obtain kernel file handle.
   // Assume that our loader booted from a device using the EFI_SIMPLE_FILE_SYSTEM_PROTOCOL.
   //
-  Status = GetKernelFile (&KernelFile);
+  Status = GetKernelFile (&KernelFile, &FastBoot);
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "JOS: Failed to obtain kernel file - %r\n", Status));
     return Status;
@@ -503,6 +694,16 @@ LoadKernel (
 
   DEBUG ((DEBUG_INFO, "JOS: Loading kernel image...\n"));
 
+#if KERNEL_READ_WHOLE_FILE
+  //
+  // Fall back to separate reads if the file does not fit in memory.
+  //
+  Status = ReadKernelImage (KernelFile);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "JOS: Reading kernel piecewise - %r\n", Status));
+  }
+#endif
+
   //
   // Read and verify ELF header.
   // TODO: Here we blindly trust that ELF file has valid data. Anybody implementing
@@ -513,6 +714,7 @@ LoadKernel (
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "JOS: Cannot read kernel header - %r\n", Status));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return Status;
   }
 
@@ -524,17 +726,25 @@ LoadKernel (
       ELF_MAGIC
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
+  LoaderParams->BootTsc[LOADER_TSC_HEADER] = AsmReadTsc ();
+
   //
   // TODO: Check other fields.
   //
 
   //
-  // Go through sections and get the needed debug information.
+  // Go through sections and get the needed debug information,
+  // unless this is a fast boot.
   //
-  DEBUG ((DEBUG_INFO, "JOS: Loading debug tables...\n"));
+  if (FastBoot) {
+    DEBUG ((DEBUG_INFO, "JOS: Fast boot, skipping debug tables\n"));
+  } else {
+    DEBUG ((DEBUG_INFO, "JOS: Loading debug tables...\n"));
+  }
 
   if (ElfHeader.e_shentsize != sizeof (struct Secthdr)) {
     DEBUG ((
@@ -544,6 +754,7 @@ LoadKernel (
       (UINT32) sizeof (struct Secthdr)
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -555,6 +766,7 @@ LoadKernel (
       ElfHeader.e_shnum
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -566,6 +778,7 @@ LoadKernel (
       (UINT32) sizeof (struct Proghdr)
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -577,6 +790,7 @@ LoadKernel (
       ElfHeader.e_shnum
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -588,6 +802,7 @@ LoadKernel (
       ElfHeader.e_phnum
       ));
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     FreePool (Sections);
     return EFI_UNSUPPORTED;
   }
@@ -608,6 +823,7 @@ LoadKernel (
     FreePool (Sections);
     FreePool (ProgramHeaders);
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -629,6 +845,7 @@ LoadKernel (
     FreePool (Sections);
     FreePool (ProgramHeaders);
     KernelFile->Close (KernelFile);
+    FreeKernelImage ();
     return EFI_UNSUPPORTED;
   }
 
@@ -648,7 +865,7 @@ LoadKernel (
 
   Status = EFI_SUCCESS;
 
-  for (Index = 0; Index < ElfHeader.e_shnum; ++Index) {
+  for (Index = 0; !FastBoot && Index < ElfHeader.e_shnum; ++Index) {
     if (Sections[Index].sh_type != ELF_SHT_PROGBITS) {
       continue;
     }
@@ -730,6 +947,8 @@ LoadKernel (
   }
 
   if (!EFI_ERROR (Status)) {
+    LoaderParams->BootTsc[LOADER_TSC_SECTIONS] = AsmReadTsc ();
+
     //
     // Allocate kernel memory.
     //
@@ -793,28 +1012,30 @@ LoadKernel (
   }
 
   //
-  // Free sections and headers.
+  // Free sections, headers and the file buffer.
   //
   FreePool (Sections);
   FreePool (ProgramHeaders);
+  FreeKernelImage ();
 
   //
   // Free allocated memory on error.
   //
   if (!EFI_ERROR (Status)) {
+    LoaderParams->BootTsc[LOADER_TSC_SEGMENTS] = AsmReadTsc ();
     DEBUG ((DEBUG_INFO, "JOS: Loaded kernel with %Lx entry point\n", ElfHeader.e_entry));
     *EntryPoint = (UINTN) ElfHeader.e_entry;
   } else {
     for (Index = 0; Index < ARRAY_SIZE (mDebugMapping); ++Index) {
       SectionData = (VOID *)(UINTN) *(EFI_PHYSICAL_ADDRESS *)(
-        (UINT8 *) LoaderParams + mDebugMapping[Index2].StartOffset);
+        (UINT8 *) LoaderParams + mDebugMapping[Index].StartOffset);
 
       if (SectionData != NULL) {
         gBS->FreePages (
           (UINTN) SectionData,
           EFI_SIZE_TO_PAGES (
-            *(EFI_PHYSICAL_ADDRESS *)((UINT8 *) LoaderParams + mDebugMapping[Index2].EndOffset)
-            - *(EFI_PHYSICAL_ADDRESS *)((UINT8 *) LoaderParams + mDebugMapping[Index2].StartOffset)
+            *(EFI_PHYSICAL_ADDRESS *)((UINT8 *) LoaderParams + mDebugMapping[Index].EndOffset)
+            - *(EFI_PHYSICAL_ADDRESS *)((UINT8 *) LoaderParams + mDebugMapping[Index].StartOffset)
             )
           );
       }
@@ -992,6 +1213,7 @@ UefiMain (
   EFI_EVENT          VirtualNotifyEvent;
   UINTN              EntryPoint;
   VOID               *GateData;
+  UINT64             EntryTsc;
 
 #if 0 ///< Uncomment to await debugging
   volatile BOOLEAN   Connected;
@@ -1003,6 +1225,8 @@ UefiMain (
   }
 #endif
 
+  EntryTsc = AsmReadTsc ();
+
   Status = gRT->GetTime (&Now, NULL);
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "JOS: Error when getting time - %r\n", Status));
@@ -1028,6 +1252,8 @@ UefiMain (
 
   ZeroMem (LoaderParams, sizeof (*LoaderParams));
 
+  LoaderParams->BootTsc[LOADER_TSC_ENTRY] = EntryTsc;
+
   LoaderParams->RTServices   = (UINTN) gRT;
   LoaderParams->ACPIRoot     = (UINTN) AcpiFindRsdp ();
   LoaderParams->SelfVirtual  = (UINTN) LoaderParams;
@@ -1084,6 +1310,7 @@ UefiMain (
     CpuDeadLoop ();
   }
 
+  LoaderParams->BootTsc[LOADER_TSC_EXIT] = AsmReadTsc ();
   CallKernelThroughGate (EntryPoint, LoaderParams, GateData);
 
   DEBUG ((DEBUG_INFO, "JOS: KernelCallGate returned\n"));
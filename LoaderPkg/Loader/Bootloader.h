@@ -29,6 +29,19 @@
 ///
 #define KERNEL_PATH L"\\EFI\\BOOT\\kernel"
 
+///
+/// If this file exists next to the kernel, the loader skips the
+/// debug sections and leaves the Debug* loader parameters zero.
+///
+#define FASTBOOT_PATH L"\\EFI\\BOOT\\fastboot"
+
+///
+/// Read the whole kernel file with one sequential read and parse it
+/// from memory. Set to 0 to read each header and section separately;
+/// LZ4-compressed kernels can only be loaded in whole-file mode.
+///
+#define KERNEL_READ_WHOLE_FILE 1
+
 /**
   Generate architecture-specific kernel call gate data.
 
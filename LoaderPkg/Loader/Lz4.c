@@ -0,0 +1,324 @@
+/** @file
+  LZ4 frame decompression for compressed kernel images.
+
+  Copyright (c) 2020, ISP RAS. All rights reserved.
+  SPDX-License-Identifier: BSD-3-Clause
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include "Lz4.h"
+
+//
+// Frame descriptor flag bits.
+//
+#define LZ4_FLG_VERSION_MASK    0xC0
+#define LZ4_FLG_VERSION         0x40
+#define LZ4_FLG_BLOCK_CHECKSUM  0x10
+#define LZ4_FLG_CONTENT_SIZE    0x08
+#define LZ4_FLG_DICT_ID         0x01
+
+//
+// Block size word: the top bit marks a stored (uncompressed) block.
+//
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000U
+
+#define LZ4_MIN_MATCH           4
+
+STATIC
+UINT32
+Lz4Read32 (
+  IN  CONST UINT8  *Data
+  )
+{
+  return (UINT32) Data[0] | ((UINT32) Data[1] << 8)
+    | ((UINT32) Data[2] << 16) | ((UINT32) Data[3] << 24);
+}
+
+/**
+  Parse the frame descriptor.
+
+  @param[in]  Data         Frame contents.
+  @param[in]  Size         Frame size.
+  @param[out] Flags        Frame descriptor flags.
+  @param[out] ContentSize  Content size, or 0 if not recorded.
+  @param[out] HeaderSize   Size of magic and frame descriptor.
+
+  @retval EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+Lz4ParseHeader (
+  IN  CONST UINT8  *Data,
+  IN  UINTN        Size,
+  OUT UINT8        *Flags,
+  OUT UINT64       *ContentSize,
+  OUT UINTN        *HeaderSize
+  )
+{
+  UINTN  Offset;
+
+  //
+  // Magic, FLG, BD and the header checksum at the least.
+  //
+  if (Size < 7 || Lz4Read32 (Data) != LZ4_FRAME_MAGIC) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  *Flags = Data[4];
+  if ((*Flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Offset       = 6;
+  *ContentSize = 0;
+  if ((*Flags & LZ4_FLG_CONTENT_SIZE) != 0) {
+    if (Size < Offset + 8 + 1) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    *ContentSize = Lz4Read32 (Data + Offset) | LShiftU64 (Lz4Read32 (Data + Offset + 4), 32);
+    Offset      += 8;
+  }
+
+  if ((*Flags & LZ4_FLG_DICT_ID) != 0) {
+    Offset += 4;
+  }
+
+  //
+  // Skip the header checksum byte.
+  //
+  Offset += 1;
+  if (Offset > Size) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  *HeaderSize = Offset;
+  return EFI_SUCCESS;
+}
+
+/**
+  Decompress one LZ4 block to the output position. Matches may refer
+  back into earlier blocks, which are all kept in the output buffer.
+
+  @param[in]      Src       Block contents.
+  @param[in]      SrcSize   Block size.
+  @param[in]      DstStart  Start of the output buffer.
+  @param[in, out] DstPos    Output position.
+  @param[in]      DstEnd    End of the output buffer.
+
+  @retval EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+Lz4DecompressBlock (
+  IN     CONST UINT8  *Src,
+  IN     UINTN        SrcSize,
+  IN     UINT8        *DstStart,
+  IN OUT UINT8        **DstPos,
+  IN     UINT8        *DstEnd
+  )
+{
+  CONST UINT8  *SrcEnd;
+  UINT8        *Dst;
+  CONST UINT8  *Match;
+  UINTN        Length;
+  UINTN        Offset;
+  UINT8        Token;
+  UINT8        Byte;
+
+  SrcEnd = Src + SrcSize;
+  Dst    = *DstPos;
+
+  while (Src < SrcEnd) {
+    Token = *Src++;
+
+    //
+    // Literals.
+    //
+    Length = Token >> 4;
+    if (Length == 15) {
+      do {
+        if (Src >= SrcEnd) {
+          return EFI_VOLUME_CORRUPTED;
+        }
+        Byte    = *Src++;
+        Length += Byte;
+      } while (Byte == 255);
+    }
+
+    if (Length > (UINTN) (SrcEnd - Src) || Length > (UINTN) (DstEnd - Dst)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    CopyMem (Dst, Src, Length);
+    Src += Length;
+    Dst += Length;
+
+    //
+    // The last sequence of a block has literals only.
+    //
+    if (Src == SrcEnd) {
+      break;
+    }
+
+    //
+    // Match.
+    //
+    if (SrcEnd - Src < 2) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    Offset = (UINTN) Src[0] | ((UINTN) Src[1] << 8);
+    Src   += 2;
+    if (Offset == 0 || Offset > (UINTN) (Dst - DstStart)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    Length = Token & 0x0F;
+    if (Length == 15) {
+      do {
+        if (Src >= SrcEnd) {
+          return EFI_VOLUME_CORRUPTED;
+        }
+        Byte    = *Src++;
+        Length += Byte;
+      } while (Byte == 255);
+    }
+    Length += LZ4_MIN_MATCH;
+
+    if (Length > (UINTN) (DstEnd - Dst)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    //
+    // Overlapping matches repeat the last Offset bytes, so copy
+    // forward one byte at a time unless the ranges are disjoint.
+    //
+    Match = Dst - Offset;
+    if (Offset >= Length) {
+      CopyMem (Dst, Match, Length);
+      Dst += Length;
+    } else {
+      while (Length-- > 0) {
+        *Dst++ = *Match++;
+      }
+    }
+  }
+
+  *DstPos = Dst;
+  return EFI_SUCCESS;
+}
+
+BOOLEAN
+Lz4IsFrame (
+  IN  CONST VOID  *Data,
+  IN  UINTN       Size
+  )
+{
+  ASSERT (Data != NULL);
+
+  return Size >= 4 && Lz4Read32 (Data) == LZ4_FRAME_MAGIC;
+}
+
+EFI_STATUS
+Lz4FrameContentSize (
+  IN  CONST VOID  *Data,
+  IN  UINTN       Size,
+  OUT UINT64      *ContentSize
+  )
+{
+  EFI_STATUS  Status;
+  UINT8       Flags;
+  UINTN       HeaderSize;
+
+  ASSERT (Data != NULL);
+  ASSERT (ContentSize != NULL);
+
+  Status = Lz4ParseHeader (Data, Size, &Flags, ContentSize, &HeaderSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Flags & LZ4_FLG_CONTENT_SIZE) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+Lz4DecompressFrame (
+  IN  CONST VOID  *Src,
+  IN  UINTN       SrcSize,
+  OUT VOID        *Dst,
+  IN  UINTN       DstSize
+  )
+{
+  EFI_STATUS   Status;
+  CONST UINT8  *In;
+  CONST UINT8  *InEnd;
+  UINT8        *Out;
+  UINT8        *OutEnd;
+  UINT8        Flags;
+  UINT64       ContentSize;
+  UINTN        HeaderSize;
+  UINT32       BlockSize;
+  UINTN        Length;
+
+  ASSERT (Src != NULL);
+  ASSERT (Dst != NULL);
+
+  Status = Lz4ParseHeader (Src, SrcSize, &Flags, &ContentSize, &HeaderSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  In     = (CONST UINT8 *) Src + HeaderSize;
+  InEnd  = (CONST UINT8 *) Src + SrcSize;
+  Out    = Dst;
+  OutEnd = Out + DstSize;
+
+  while (TRUE) {
+    if (InEnd - In < 4) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    BlockSize = Lz4Read32 (In);
+    In       += 4;
+
+    //
+    // A zero block size is the end mark.
+    //
+    if (BlockSize == 0) {
+      break;
+    }
+
+    Length = BlockSize & ~LZ4_BLOCK_UNCOMPRESSED;
+    if (Length > (UINTN) (InEnd - In)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    if ((BlockSize & LZ4_BLOCK_UNCOMPRESSED) != 0) {
+      if (Length > (UINTN) (OutEnd - Out)) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+      CopyMem (Out, In, Length);
+      Out += Length;
+    } else {
+      Status = Lz4DecompressBlock (In, Length, Dst, &Out, OutEnd);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    }
+
+    In += Length;
+    if ((Flags & LZ4_FLG_BLOCK_CHECKSUM) != 0) {
+      In += 4;
+    }
+  }
+
+  if (Out != OutEnd) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  return EFI_SUCCESS;
+}
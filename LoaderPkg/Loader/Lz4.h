@@ -0,0 +1,66 @@
+/** @file
+  Copyright (c) 2020, ISP RAS. All rights reserved.
+  SPDX-License-Identifier: BSD-3-Clause
+**/
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <Uefi.h>
+
+///
+/// First four bytes of an LZ4 frame.
+///
+#define LZ4_FRAME_MAGIC  0x184D2204U
+
+/**
+  Check whether a buffer starts with an LZ4 frame header.
+
+  @param[in]  Data  Buffer contents.
+  @param[in]  Size  Buffer size.
+
+  @retval TRUE if the buffer starts with the LZ4 frame magic.
+**/
+BOOLEAN
+Lz4IsFrame (
+  IN  CONST VOID  *Data,
+  IN  UINTN       Size
+  );
+
+/**
+  Obtain the decompressed size recorded in an LZ4 frame header.
+
+  @param[in]  Data         Frame contents.
+  @param[in]  Size         Frame size.
+  @param[out] ContentSize  Decompressed size.
+
+  @retval EFI_SUCCESS on success.
+  @retval EFI_UNSUPPORTED if the frame does not record its size.
+**/
+EFI_STATUS
+Lz4FrameContentSize (
+  IN  CONST VOID  *Data,
+  IN  UINTN       Size,
+  OUT UINT64      *ContentSize
+  );
+
+/**
+  Decompress a whole LZ4 frame. Checksums are not verified.
+
+  @param[in]  Src      Frame contents.
+  @param[in]  SrcSize  Frame size.
+  @param[out] Dst      Output buffer.
+  @param[in]  DstSize  Output buffer size, must equal the content size.
+
+  @retval EFI_SUCCESS on success.
+  @retval EFI_VOLUME_CORRUPTED if the frame is malformed.
+**/
+EFI_STATUS
+Lz4DecompressFrame (
+  IN  CONST VOID  *Src,
+  IN  UINTN       SrcSize,
+  OUT VOID        *Dst,
+  IN  UINTN       DstSize
+  );
+
+#endif // LZ4_H
@@ -207,15 +207,24 @@ extern volatile pml4e_t uvpml4e[]; // VA of current page map level 4
  * with page2pa() in kern/pmap.h.
  */
 struct PageInfo {
-  // Next page on the free list.
+  // Next and previous free block of the same order.  Only the
+  // first page of a free block is on a list.
   struct PageInfo *pp_link;
+  struct PageInfo *pp_prev;
 
   // pp_ref is the count of pointers (usually in page table entries)
   // to this page, for pages allocated using page_alloc.
-  // Pages allocated at boot time using pmap.c's
-  // boot_alloc do not have valid reference count fields.
+  // Pages allocated at boot time by pmap.c's early allocator
+  // do not have valid reference count fields.
 
   uint16_t pp_ref;
+
+  // Order of a block kmalloc took straight from the page allocator,
+  // in the block's first page.
+  uint8_t pp_order;
+
+  // Slab header of the kern/kmem.c slab the page belongs to, or NULL.
+  void *pp_slab;
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -61,6 +61,9 @@
 #define PTSIZE  (PGSIZE * NPTENTRIES) // bytes mapped by a page directory entry
 #define PTSHIFT 21                    // log2(PTSIZE)
 
+#define PDPSIZE  (PTSIZE * NPDENTRIES) // bytes mapped by a page directory pointer entry
+#define PDPSHIFT 30                    // log2(PDPSIZE)
+
 #define PTXSHIFT  12 // offset of PTX in a linear address
 #define PDXSHIFT  21 // offset of PDX in a linear address
 #define PDPESHIFT 30
@@ -77,6 +80,13 @@
 #define PTE_PS  0x080 // Page Size
 #define PTE_G   0x100 // Global
 #define PTE_MBZ 0x180 // Bits must be zero
+#define PTE_NX  0x8000000000000000ULL // No-execute, needs EFER_NXE
+
+// PAT index bit in 2MB/1GB page entries (bit 7 there is PTE_PS).
+#define PTE_PAT_LARGE 0x1000
+
+// Memory type selected by PTE_PWT with the PAT layout set by the kernel.
+#define PTE_WC PTE_PWT
 
 // The PTE_AVAIL bits aren't used by the kernel or interpreted by the
 // hardware, so user processes are allowed to set them arbitrarily.
@@ -108,11 +118,61 @@
 #define CR4_TSD 0x00000004 // Time Stamp Disable
 #define CR4_PVI 0x00000002 // Protected-Mode Virtual Interrupts
 #define CR4_VME 0x00000001 // V86 Mode Extensions
+#define CR4_OSFXSR     0x00000200 // FXSAVE/FXRSTOR and SSE enable
+#define CR4_OSXMMEXCPT 0x00000400 // Unmasked SSE exceptions
+#define CR4_OSXSAVE    0x00040000 // XSAVE and XCR0 enable
+#define CR4_PGE        0x00000080 // Global pages enable
+#define CR4_PCIDE      0x00020000 // Process-context identifiers enable
+
+// CR3 bits used with CR4_PCIDE
+#define CR3_PCID_MASK    0xFFF                  // PCID of the address space
+#define CR3_PCID_NOFLUSH 0x8000000000000000ULL  // Keep TLB entries of the new PCID
 
 //x86_64 related changes
 #define CR4_PAE  0x00000020
 #define EFER_MSR 0xC0000080
 #define EFER_LME 8
+#define EFER_NXE (1 << 11) // No-execute enable
+
+// Page Attribute Table MSR and memory types
+#define PAT_MSR 0x277
+#define PAT_UC  0x00 // Uncacheable
+#define PAT_WC  0x01 // Write-combining
+#define PAT_WT  0x04 // Write-through
+#define PAT_WP  0x05 // Write-protected
+#define PAT_WB  0x06 // Write-back
+#define PAT_UCM 0x07 // Uncached, overridable by MTRRs (UC-)
+
+// PAT layout used by the kernel: the power-on default except that
+// entry 1 (PWT set, PCD and PAT clear) is write-combining.
+#define PAT_ENTRY(i, type) ((uint64_t)(type) << ((i)*8))
+#define PAT_KERNEL                               \
+  (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WC) |  \
+   PAT_ENTRY(2, PAT_UCM) | PAT_ENTRY(3, PAT_UC) | \
+   PAT_ENTRY(4, PAT_WB) | PAT_ENTRY(5, PAT_WT) |  \
+   PAT_ENTRY(6, PAT_UCM) | PAT_ENTRY(7, PAT_UC))
+
+// CPUID.1:EDX feature flags
+#define CPUID_EDX_PAT 0x00010000
+
+// CPUID.80000001H:EDX feature flags
+#define CPUID_EXT_EDX_NX      0x00100000 // No-execute pages
+#define CPUID_EXT_EDX_PDPE1GB 0x04000000 // 1GB pages
+
+// CPUID.1:ECX feature flags
+#define CPUID_ECX_PCID    0x00020000
+#define CPUID_ECX_XSAVE   0x04000000
+#define CPUID_ECX_OSXSAVE 0x08000000
+#define CPUID_ECX_AVX     0x10000000
+
+// CPUID.(EAX=7,ECX=0):EBX feature flags
+#define CPUID7_EBX_AVX2 0x00000020
+#define CPUID7_EBX_ERMS 0x00000200 // Enhanced rep movsb/stosb
+
+// XCR0 state components
+#define XCR0_X87 0x1
+#define XCR0_SSE 0x2
+#define XCR0_AVX 0x4
 
 // Eflags register
 #define FL_CF        0x00000001 // Carry Flag
@@ -2,6 +2,7 @@
 #define JOS_INC_STDIO_H
 
 #include <inc/stdarg.h>
+#include <inc/types.h>
 
 #ifndef NULL
 #define NULL ((void *)0)
@@ -12,15 +13,58 @@ void cputchar(int c);
 int getchar(void);
 int iscons(int fd);
 
+// One literal run or %-conversion of a parsed format string.
+struct fmtop {
+  const char *lit; // literal text, if conv is 0
+  uint32_t len;
+  char conv; // conversion character, or 0 for literal text
+  char padc;
+  uint8_t lflag;
+  uint8_t flags;
+  int width;
+  int precision;
+};
+#define FMTOP_ALT            0x1 // '#' flag
+#define FMTOP_STAR_WIDTH     0x2 // width is taken from the arguments
+#define FMTOP_STAR_PRECISION 0x4 // precision is taken from the arguments
+
+// A format string together with its parsed form, filled in on first use.
+#define PRINTFMT_MAXOPS 12
+struct printfmt_desc {
+  const char *fmt;
+  uint8_t state; // PRINTFMT_*
+  uint8_t nops;
+  struct fmtop ops[PRINTFMT_MAXOPS];
+};
+#define PRINTFMT_NEW     0 // not parsed yet
+#define PRINTFMT_PARSED  1 // ops[] is valid
+#define PRINTFMT_DYNAMIC 2 // too many pieces, parsed on every call
+
 // lib/printfmt.c
 void printfmt(void (*putch)(int, void *), void *putdat, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 void vprintfmt(void (*putch)(int, void *), void *putdat, const char *fmt, va_list) __attribute__((format(printf, 3, 0)));
+void printfmt_span(void (*write)(const char *, size_t, void *), void *ctx, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void vprintfmt_span(void (*write)(const char *, size_t, void *), void *ctx, const char *fmt, va_list) __attribute__((format(printf, 3, 0)));
+void vprintfmt_desc(void (*write)(const char *, size_t, void *), void *ctx, struct printfmt_desc *d, va_list);
 int snprintf(char *str, int size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 int vsnprintf(char *str, int size, const char *fmt, va_list) __attribute__((format(printf, 3, 0)));
 
 // lib/printf.c
 int cprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 int vcprintf(const char *fmt, va_list) __attribute__((format(printf, 1, 0)));
+int cprintf_desc(struct printfmt_desc *d, ...);
+int vcprintf_desc(struct printfmt_desc *d, va_list);
+
+// cprintf for hot call sites.  The format must be a string literal;
+// it is checked against the arguments like any cprintf format, parsed
+// on the first call into a static descriptor, and not parsed again.
+#define cprintf_hot(fmt, ...)                                \
+  ({                                                         \
+    static struct printfmt_desc __printfmt_desc = {"" fmt};  \
+    if (0)                                                   \
+      cprintf(fmt, ##__VA_ARGS__);                           \
+    cprintf_desc(&__printfmt_desc, ##__VA_ARGS__);           \
+  })
 
 // lib/readline.c
 char *readline(const char *prompt);
@@ -34,7 +34,13 @@ static __inline void write_rflags(uint64_t rflags) __attribute__((always_inline)
 static __inline uint64_t read_rbp(void) __attribute__((always_inline));
 static __inline uint64_t read_rsp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
+static __inline void cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
+static __inline uint64_t xgetbv(uint32_t xcr) __attribute__((always_inline));
+static __inline void xsetbv(uint32_t xcr, uint64_t val) __attribute__((always_inline));
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline uint64_t rdmsr(uint32_t msr) __attribute__((always_inline));
+static __inline void wrmsr(uint32_t msr, uint64_t val) __attribute__((always_inline));
+static __inline void wbinvd(void) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void) {
@@ -283,6 +289,39 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
     *edxp = edx;
 }
 
+// cpuid for leaves that take a subleaf index in ECX.
+static __inline void
+cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp) {
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile("cpuid"
+               : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+               : "a"(info), "c"(subleaf));
+  if (eaxp)
+    *eaxp = eax;
+  if (ebxp)
+    *ebxp = ebx;
+  if (ecxp)
+    *ecxp = ecx;
+  if (edxp)
+    *edxp = edx;
+}
+
+static __inline uint64_t
+xgetbv(uint32_t xcr) {
+  uint32_t lo, hi;
+  __asm __volatile("xgetbv"
+                   : "=a"(lo), "=d"(hi)
+                   : "c"(xcr));
+  return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+static __inline void
+xsetbv(uint32_t xcr, uint64_t val) {
+  __asm __volatile("xsetbv"
+                   :
+                   : "c"(xcr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
 static __inline uint64_t
 read_tsc(void) {
   uint32_t lo, hi;
@@ -293,6 +332,28 @@ read_tsc(void) {
   return res;
 }
 
+static __inline uint64_t
+rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  __asm __volatile("rdmsr"
+                   : "=a"(lo), "=d"(hi)
+                   : "c"(msr));
+  return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+static __inline void
+wrmsr(uint32_t msr, uint64_t val) {
+  __asm __volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static __inline void
+wbinvd(void) {
+  __asm __volatile("wbinvd" ::
+                       : "memory");
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr, uint32_t newval) {
   uint32_t result;
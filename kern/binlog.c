@@ -0,0 +1,102 @@
+// Binary trace log: format pointers and raw arguments,
+// formatted only when the log is read.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/x86.h>
+
+#include <kern/binlog.h>
+
+struct binlog_record {
+  // Sequence number plus one once the record is committed,
+  // zero while a writer is still filling it in.
+  volatile uint64_t seq;
+  uint64_t tsc;
+  const char *fmt;
+  uint64_t nargs;
+  uint64_t args[BINLOG_MAXARGS];
+};
+
+static struct binlog_record binlog_ring[BINLOG_NRECORDS];
+
+static volatile uint64_t binlog_head; // next sequence number to reserve
+static uint64_t binlog_shown;         // next sequence number to dump
+
+// Parsed formats of recently dumped records, by format address.
+#define BINLOG_NFMTS 32 // must be a power of 2
+static struct printfmt_desc binlog_fmts[BINLOG_NFMTS];
+
+// Store one trace record.  This is the only part that runs at the
+// trace point: a slot reservation, rdtsc and a few stores.  It is safe
+// in interrupt context, like klog_write().
+void
+binlog_write(const char *fmt, unsigned nargs, const uint64_t *args) {
+  uint64_t seq = __atomic_fetch_add(&binlog_head, 1, __ATOMIC_RELAXED);
+  struct binlog_record *rec = &binlog_ring[seq & (BINLOG_NRECORDS - 1)];
+  unsigned i;
+
+  __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  rec->tsc   = read_tsc();
+  rec->fmt   = fmt;
+  rec->nargs = nargs;
+  for (i = 0; i < nargs && i < BINLOG_MAXARGS; i++)
+    rec->args[i] = args[i];
+  __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Hand the saved arguments back to the formatter.  On x86-64 every
+// integer or pointer argument occupies a 64-bit slot, so vprintfmt can
+// fetch an int, a long or a pointer from a uint64_t passed here.
+static void
+binlog_print(struct printfmt_desc *d, ...) {
+  va_list ap;
+
+  va_start(ap, d);
+  vcprintf_desc(d, ap);
+  va_end(ap);
+}
+
+// Descriptor for a record's format, so that each distinct trace point
+// is parsed once rather than once per record.
+static struct printfmt_desc *
+binlog_fmt(const char *fmt) {
+  struct printfmt_desc *d = &binlog_fmts[((uintptr_t)fmt >> 3) & (BINLOG_NFMTS - 1)];
+
+  if (d->fmt != fmt)
+    *d = (struct printfmt_desc){fmt};
+  return d;
+}
+
+// Format and print the records written since the last dump, or all
+// records still held in the ring if 'all' is set.
+void
+binlog_dump(bool all) {
+  uint64_t head = binlog_head, seq, lost = 0;
+  uint64_t first = head > BINLOG_NRECORDS ? head - BINLOG_NRECORDS : 0;
+
+  seq = all ? first : binlog_shown;
+  if (seq < first) {
+    lost = first - seq;
+    seq  = first;
+  }
+
+  for (; seq < head; seq++) {
+    struct binlog_record *rec = &binlog_ring[seq & (BINLOG_NRECORDS - 1)];
+    struct binlog_record copy = *rec;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (copy.seq != seq + 1 || rec->seq != seq + 1) {
+      // still being written, or overwritten while we copied it
+      lost++;
+      continue;
+    }
+    cprintf_hot("[%16lu] ", (unsigned long)copy.tsc);
+    binlog_print(binlog_fmt(copy.fmt), copy.args[0], copy.args[1], copy.args[2],
+                 copy.args[3], copy.args[4], copy.args[5]);
+  }
+  binlog_shown = head;
+
+  if (lost)
+    cprintf("%lu records lost\n", (unsigned long)lost);
+}
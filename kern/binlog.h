@@ -0,0 +1,47 @@
+#ifndef JOS_KERN_BINLOG_H
+#define JOS_KERN_BINLOG_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+
+// Binary trace log.
+//
+// binlog(fmt, ...) records only the format string pointer, the TSC and
+// up to BINLOG_MAXARGS arguments widened to 64 bits.  Nothing is
+// formatted until the log is dumped from the monitor, so a trace point
+// costs a few dozen cycles.  The format must be a string literal, since
+// only its address is kept; it is checked against the arguments like a
+// cprintf format.  Floating-point arguments are not supported.
+
+#define BINLOG_NRECORDS 1024 // must be a power of 2
+#define BINLOG_MAXARGS  6
+
+#define binlog(fmt, ...)                                               \
+  do {                                                                 \
+    if (0)                                                             \
+      cprintf(fmt, ##__VA_ARGS__);                                     \
+    binlog_write("" fmt, BINLOG_NARGS(__VA_ARGS__),                    \
+                 (const uint64_t[]){BINLOG_CAST(__VA_ARGS__)});        \
+  } while (0)
+
+void binlog_write(const char *fmt, unsigned nargs, const uint64_t *args);
+void binlog_dump(bool all);
+
+// Argument counting and widening for binlog().
+#define BINLOG_NARGS(...)                                  BINLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define BINLOG_CAST(...)                                   BINLOG_CAST_N(BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define BINLOG_CAST_N(n, ...)                              BINLOG_CAST_N_(n, ##__VA_ARGS__)
+#define BINLOG_CAST_N_(n, ...)                             BINLOG_CAST_##n(__VA_ARGS__)
+#define BINLOG_CAST_0()                                    0
+#define BINLOG_CAST_1(a)                                   (uint64_t)(a)
+#define BINLOG_CAST_2(a, b)                                (uint64_t)(a), (uint64_t)(b)
+#define BINLOG_CAST_3(a, b, c)                             (uint64_t)(a), (uint64_t)(b), (uint64_t)(c)
+#define BINLOG_CAST_4(a, b, c, d)                          BINLOG_CAST_2(a, b), BINLOG_CAST_2(c, d)
+#define BINLOG_CAST_5(a, b, c, d, e)                       BINLOG_CAST_2(a, b), BINLOG_CAST_3(c, d, e)
+#define BINLOG_CAST_6(a, b, c, d, e, f)                    BINLOG_CAST_3(a, b, c), BINLOG_CAST_3(d, e, f)
+
+#endif // !JOS_KERN_BINLOG_H
@@ -0,0 +1,57 @@
+// Boot phase timing from the TSC stamps of the loader and the kernel.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/uefi.h>
+
+#include <kern/boottime.h>
+#include <kern/tsc.h>
+
+uint64_t boot_tsc[BOOT_TSC_COUNT];
+
+static const char *const loader_tsc_names[LOADER_TSC_COUNT] = {
+    [LOADER_TSC_ENTRY]    = "loader: UefiMain entry",
+    [LOADER_TSC_HEADER]   = "loader: kernel header",
+    [LOADER_TSC_SECTIONS] = "loader: debug sections",
+    [LOADER_TSC_SEGMENTS] = "loader: kernel segments",
+    [LOADER_TSC_EXIT]     = "loader: exit boot services",
+};
+
+static const char *const boot_tsc_names[BOOT_TSC_COUNT] = {
+    [BOOT_TSC_HEAD64] = "kernel: _head64",
+    [BOOT_TSC_INIT]   = "kernel: i386_init",
+    [BOOT_TSC_PML4]   = "kernel: early_boot_pml4_init",
+    [BOOT_TSC_CONS]   = "kernel: cons_init",
+    [BOOT_TSC_CTORS]  = "kernel: constructors",
+    [BOOT_TSC_FB]     = "kernel: fb_init",
+};
+
+static void
+boottime_line(const char *name, uint64_t tsc, uint64_t *first, uint64_t *prev) {
+  if (!tsc)
+    return;
+  if (!*first)
+    *first = *prev = tsc;
+  cprintf("  %-30s %10lu %10lu\n", name,
+          (unsigned long)tsc_to_us(tsc - *prev), (unsigned long)tsc_to_us(tsc - *first));
+  *prev = tsc;
+}
+
+// Print the time spent before each boot milestone and since the first
+// one, in microseconds.  Milestones that were not reached are skipped.
+void
+boottime_print(void) {
+  uint64_t first = 0, prev = 0;
+  int i;
+
+  if (!tsc_freq) {
+    cprintf("TSC frequency unknown\n");
+    return;
+  }
+
+  cprintf("  %-30s %10s %10s\n", "milestone", "delta us", "total us");
+  for (i = 0; i < LOADER_TSC_COUNT; i++)
+    boottime_line(loader_tsc_names[i], uefi_lp->BootTsc[i], &first, &prev);
+  for (i = 0; i < BOOT_TSC_COUNT; i++)
+    boottime_line(boot_tsc_names[i], boot_tsc[i], &first, &prev);
+}
@@ -0,0 +1,31 @@
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// Kernel boot milestones, in the order they are reached.  The loader
+// records its own ones in uefi_lp->BootTsc.
+enum {
+  BOOT_TSC_HEAD64 = 0, // _head64 entry; stored by entry.S, must stay 0
+  BOOT_TSC_INIT,       // i386_init entry
+  BOOT_TSC_PML4,       // early_boot_pml4_init done
+  BOOT_TSC_CONS,       // cons_init done
+  BOOT_TSC_CTORS,      // global constructors done
+  BOOT_TSC_FB,         // fb_init done
+  BOOT_TSC_COUNT
+};
+
+extern uint64_t boot_tsc[BOOT_TSC_COUNT];
+
+static inline void
+boot_stamp(int which) {
+  boot_tsc[which] = read_tsc();
+}
+
+void boottime_print(void);
+
+#endif // !JOS_KERN_BOOTTIME_H
@@ -5,8 +5,13 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+
+#include <inc/trap.h>
 
 #include <kern/console.h>
+#include <kern/klog.h>
+#include <kern/picirq.h>
 #include <inc/uefi.h>
 
 static bool graphics_exists = false;
@@ -17,7 +22,6 @@ static uint32_t crt_cols;
 static uint32_t crt_size;
 
 static void cons_intr(int (*proc)(void));
-static void cons_putc(int c);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -223,7 +227,7 @@ serial_putc(int c) {
   outb(COM1 + COM_TX, c);
 }
 
-static void
+static bool
 serial_init(void) {
   // Turn off the FIFO
   outb(COM1 + COM_FCR, 0);
@@ -236,8 +240,8 @@ serial_init(void) {
   // 8 data bits, 1 stop bit, parity off; turn off DLAB latch
   outb(COM1 + COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-  // No modem controls
-  outb(COM1 + COM_MCR, 0);
+  // No modem controls, but OUT2 gates the IRQ line on PC hardware
+  outb(COM1 + COM_MCR, COM_MCR_OUT2);
   // Enable rcv interrupts
   outb(COM1 + COM_IER, COM_IER_RDI);
 
@@ -246,27 +250,82 @@ serial_init(void) {
   serial_exists = (inb(COM1 + COM_LSR) != 0xFF);
   (void)inb(COM1 + COM_IIR);
   (void)inb(COM1 + COM_RX);
+
+  // Enable serial interrupts
+  if (serial_exists)
+    irq_setmask_8259A(irq_mask_8259A & ~(1 << IRQ_SERIAL));
+
+  return serial_exists;
 }
 
 /***** Parallel port output code *****/
 // For information on PC parallel port programming, see the class References
 // page.
 
+#define LPT1 0x378
+
+static bool
+lpt_probe(void) {
+  // The data latch of a present port reads back what was written,
+  // while an absent port floats to 0xFF.
+  outb(LPT1 + 0, 0xAA);
+  return inb(LPT1 + 0) == 0xAA;
+}
+
 static void
 lpt_putc(int c) {
   int i;
 
-  for (i = 0; !(inb(0x378 + 1) & 0x80) && i < 12800; i++)
+  for (i = 0; !(inb(LPT1 + 1) & 0x80) && i < 12800; i++)
     delay();
-  outb(0x378 + 0, c);
-  outb(0x378 + 2, 0x08 | 0x04 | 0x01);
-  outb(0x378 + 2, 0x08);
+  outb(LPT1 + 0, c);
+  outb(LPT1 + 2, 0x08 | 0x04 | 0x01);
+  outb(LPT1 + 2, 0x08);
+}
+
+/***** Debug console output *****/
+// Bochs and QEMU (-debugcon) provide a port that takes one byte per outb
+// and needs no status polling.  Good for high-volume logs under emulation.
+
+#ifndef DEBUGCON_PORT
+#define DEBUGCON_PORT 0xE9
+#endif
+
+static bool
+debugcon_probe(void) {
+  // Reads from the port return 0xE9 when the device is there.
+  return inb(DEBUGCON_PORT) == 0xE9;
+}
+
+static void
+debugcon_putc(int c) {
+  outb(DEBUGCON_PORT, c);
+}
+
+static void
+debugcon_write(const char *s, size_t n) {
+  outsb(DEBUGCON_PORT, s, n);
 }
 
 /***** Text-mode framebuffer display output *****/
 
 static uint32_t *crt_buf = (uint32_t *)FBUFFBASE;
 static uint16_t crt_pos;
+static bool crt_cleared = false;
+
+static bool
+fb_probe(void) {
+  return uefi_lp->FrameBufferBase != 0 &&
+         uefi_lp->HorizontalResolution != 0 &&
+         uefi_lp->VerticalResolution != 0;
+}
+
+static void
+fb_clear(void) {
+  memset(crt_buf, 0, uefi_lp->FrameBufferSize);
+  crt_pos     = crt_cols;
+  crt_cleared = true;
+}
 
 void
 fb_init(void) {
@@ -278,10 +337,12 @@ fb_init(void) {
   crt_size          = crt_rows * crt_cols;
   crt_pos           = crt_cols;
 
-  // Clear screen
-  memset(crt_buf, 0, lp->FrameBufferSize);
-
   graphics_exists = true;
+
+  // Clear screen, unless the framebuffer output is disabled;
+  // then it is cleared when the output gets enabled.
+  if (cons_backend_find("fb")->enabled)
+    fb_clear();
 }
 
 static void
@@ -308,11 +369,11 @@ fb_putc(int c) {
       crt_pos -= (crt_pos % crt_cols);
       break;
     case '\t':
-      cons_putc(' ');
-      cons_putc(' ');
-      cons_putc(' ');
-      cons_putc(' ');
-      cons_putc(' ');
+      fb_putc(' ');
+      fb_putc(' ');
+      fb_putc(' ');
+      fb_putc(' ');
+      fb_putc(' ');
       break;
     default:
       draw_char(crt_buf, crt_pos % crt_cols, crt_pos / crt_cols, 0xffffffff, (char)c); /* write the character */
@@ -480,8 +541,99 @@ kbd_intr(void) {
   cons_intr(kbd_proc_data);
 }
 
+// Wait until the keyboard controller can take a command or data byte.
+static bool
+kbd_wait_write(void) {
+  int i;
+
+  for (i = 0; (inb(KBSTATP) & KBS_IBF) && i < 12800; i++)
+    delay();
+  return !(inb(KBSTATP) & KBS_IBF);
+}
+
 static void
 kbd_init(void) {
+  uint8_t cmd;
+  int i;
+
+  // No controller: the status port floats to 0xFF.
+  if (inb(KBSTATP) == 0xFF)
+    return;
+
+  // Firmware may leave the controller in polled mode;
+  // set the command byte bit that routes keystrokes to IRQ 1.
+  if (!kbd_wait_write())
+    return;
+  outb(KBCMDP, KBC_RAMREAD);
+  for (i = 0; !(inb(KBSTATP) & KBS_DIB) && i < 12800; i++)
+    delay();
+  cmd = inb(KBDATAP);
+  if (!kbd_wait_write())
+    return;
+  outb(KBCMDP, KBC_RAMWRITE);
+  if (!kbd_wait_write())
+    return;
+  outb(KBOUTP, cmd | KC8_KENABLE);
+
+  // Enable interrupts from the keyboard
+  irq_setmask_8259A(irq_mask_8259A & ~(1 << IRQ_KBD));
+}
+
+/***** Console output backends *****/
+// Every output device is described by a backend entry.  Backends are
+// probed once in cons_init; absent ones are never called, and present
+// ones can be switched on and off at runtime from the monitor.
+
+#ifdef CONS_HEADLESS
+#define CONS_SCREEN_ON false
+#else
+#define CONS_SCREEN_ON true
+#endif
+
+#ifdef CONFIG_DEBUGCON
+#define CONS_DEBUGCON_ON true
+#else
+#define CONS_DEBUGCON_ON false
+#endif
+
+static struct cons_backend cons_backends[] = {
+    {"serial", serial_init, serial_putc, NULL, false, true},
+    {"lpt", lpt_probe, lpt_putc, NULL, false, CONS_SCREEN_ON},
+    {"fb", fb_probe, fb_putc, NULL, false, CONS_SCREEN_ON},
+    {"debugcon", debugcon_probe, debugcon_putc, debugcon_write, false, CONS_DEBUGCON_ON},
+};
+#define NBACKENDS (sizeof(cons_backends) / sizeof(cons_backends[0]))
+
+// Return the i'th backend, or NULL past the end of the table.
+struct cons_backend *
+cons_backend_at(int i) {
+  if (i < 0 || i >= NBACKENDS)
+    return NULL;
+  return &cons_backends[i];
+}
+
+struct cons_backend *
+cons_backend_find(const char *name) {
+  int i;
+
+  for (i = 0; i < NBACKENDS; i++)
+    if (strcmp(cons_backends[i].name, name) == 0)
+      return &cons_backends[i];
+  return NULL;
+}
+
+// Enable or disable output to a backend.
+// Returns -E_INVAL if there is no such backend or its device is absent.
+int
+cons_backend_enable(const char *name, bool enable) {
+  struct cons_backend *b = cons_backend_find(name);
+
+  if (!b || !b->present)
+    return -E_INVAL;
+  if (enable && b->putc == fb_putc && graphics_exists && !crt_cleared)
+    fb_clear();
+  b->enabled = enable;
+  return 0;
 }
 
 /***** General device-independent console code *****/
@@ -536,16 +688,46 @@ cons_getc(void) {
 // output a character to the console
 static void
 cons_putc(int c) {
-  serial_putc(c);
-  lpt_putc(c);
-  fb_putc(c);
+  struct cons_backend *b;
+
+  for (b = cons_backends; b < cons_backends + NBACKENDS; b++)
+    if (b->present && b->enabled)
+      b->putc(c);
+}
+
+// write a span of characters to a single backend, even a disabled one
+void
+cons_backend_write(struct cons_backend *b, const char *s, size_t n) {
+  size_t i;
+
+  if (!b->present)
+    return;
+  if (b->write)
+    b->write(s, n);
+  else
+    for (i = 0; i < n; i++)
+      b->putc(s[i]);
+}
+
+// write a span of characters to the console, bypassing the kernel log
+void
+cons_write(const char *s, size_t n) {
+  struct cons_backend *b;
+
+  for (b = cons_backends; b < cons_backends + NBACKENDS; b++)
+    if (b->enabled)
+      cons_backend_write(b, s, n);
 }
 
 // initialize the console devices
 void
 cons_init(void) {
+  struct cons_backend *b;
+
   kbd_init();
-  serial_init();
+
+  for (b = cons_backends; b < cons_backends + NBACKENDS; b++)
+    b->present = b->probe();
 
   if (!serial_exists)
     cprintf("Serial port does not exist!\n");
@@ -555,6 +737,8 @@ cons_init(void) {
 
 void
 cputchar(int c) {
+  // Keep echoed characters behind any log output still pending.
+  klog_drain();
   cons_putc(c);
 }
 
@@ -562,8 +746,16 @@ int
 getchar(void) {
   int c;
 
-  while ((c = cons_getc()) == 0)
-    /* do nothing */;
+  klog_drain();
+  while ((c = cons_getc()) == 0) {
+    // Sleep until the keyboard or serial IRQ handler fills the input
+    // buffer rather than spinning.  Interrupts are only enabled for the
+    // duration of hlt: the sti shadow makes sure a wakeup cannot slip in
+    // between the buffer check above and the halt.
+    if (irq_enabled(IRQ_KBD) || irq_enabled(IRQ_SERIAL))
+      __asm __volatile("sti; hlt; cli" ::
+                           : "memory");
+  }
   return c;
 }
 
@@ -13,9 +13,25 @@
 #define CRT_SIZE    (CRT_ROWS * CRT_COLS)
 #define SYMBOL_SIZE 8
 
+// A console output device.
+struct cons_backend {
+  const char *name;
+  bool (*probe)(void);                    // detect and initialize the device
+  void (*putc)(int c);                    // output one character
+  void (*write)(const char *s, size_t n); // output a span, may be NULL
+  bool present;                           // set by probe in cons_init
+  bool enabled;                           // toggled from the monitor
+};
+
 void cons_init(void);
 void fb_init(void);
 int cons_getc(void);
+void cons_write(const char *s, size_t n);
+
+struct cons_backend *cons_backend_at(int i);
+struct cons_backend *cons_backend_find(const char *name);
+int cons_backend_enable(const char *name, bool enable);
+void cons_backend_write(struct cons_backend *b, const char *s, size_t n);
 
 void kbd_intr(void);    // irq 1
 void serial_intr(void); // irq 4
@@ -5,82 +5,146 @@
 #include <inc/assert.h>
 #include <inc/uefi.h>
 #include <inc/memlayout.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/klog.h>
+#include <kern/tsc.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/boottime.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
 
-pde_t *
-alloc_pde_early_boot(void) {
-  //Assume pde1, pde2 is already used.
-  extern uintptr_t pdefreestart, pdefreeend;
-  pde_t *ret;
-  static uintptr_t pdefree = (uintptr_t)&pdefreestart;
-
-  if (pdefree >= (uintptr_t)&pdefreeend)
-    return NULL;
-
-  ret = (pde_t *)pdefree;
-  pdefree += PGSIZE;
-  return ret;
-}
-
+// Test the stack backtrace function (lab 1 only)
 void
-map_addr_early_boot(uintptr_t addr, uintptr_t addr_phys, size_t sz) {
-  extern uintptr_t pml4phys;
-  pml4e_t *pml4 = &pml4phys;
-  pdpe_t *pdpt;
-  pde_t *pde;
-
-  uintptr_t addr_curr, addr_curr_phys, addr_end;
-  addr_curr      = ROUNDDOWN(addr, PTSIZE);
-  addr_curr_phys = ROUNDDOWN(addr_phys, PTSIZE);
-  addr_end       = ROUNDUP(addr + sz, PTSIZE);
-
-  pdpt = (pdpe_t *)PTE_ADDR(pml4[PML4(addr_curr)]);
-  for (; addr_curr < addr_end; addr_curr += PTSIZE, addr_curr_phys += PTSIZE) {
-    pde = (pde_t *)PTE_ADDR(pdpt[PDPE(addr_curr)]);
-    if (!pde) {
-      pde                   = alloc_pde_early_boot();
-      pdpt[PDPE(addr_curr)] = ((uintptr_t)pde) | PTE_P | PTE_W;
-    }
-    pde[PDX(addr_curr)] = addr_curr_phys | PTE_P | PTE_W | PTE_MBZ;
-  }
+test_backtrace(int x) {
+  cprintf("entering test_backtrace %d\n", x);
+  if (x > 0)
+    test_backtrace(x - 1);
+  else
+    mon_backtrace(0, 0, 0);
+  cprintf("leaving test_backtrace %d\n", x);
 }
+
 // Additionally maps pml4 memory so that we dont get memory errors on accessing
 // uefi_lp, MemMap, KASAN functions.
 void
 early_boot_pml4_init(void) {
 
-  map_addr_early_boot((uintptr_t)uefi_lp, (uintptr_t)uefi_lp, sizeof(LOADER_PARAMS));
-  map_addr_early_boot((uintptr_t)uefi_lp->MemoryMap, (uintptr_t)uefi_lp->MemoryMap, uefi_lp->MemoryMapSize);
+  map_addr_early_boot((uintptr_t)uefi_lp, (uintptr_t)uefi_lp, sizeof(LOADER_PARAMS), 0);
+  map_addr_early_boot((uintptr_t)uefi_lp->MemoryMap, (uintptr_t)uefi_lp->MemoryMap, uefi_lp->MemoryMapSize, 0);
 
 #ifdef SANITIZE_SHADOW_BASE
-  map_addr_early_boot(SANITIZE_SHADOW_BASE, SANITIZE_SHADOW_BASE - KERNBASE, SANITIZE_SHADOW_SIZE);
+  map_addr_early_boot(SANITIZE_SHADOW_BASE, SANITIZE_SHADOW_BASE - KERNBASE, SANITIZE_SHADOW_SIZE, 0);
 #endif
 
-  map_addr_early_boot(FBUFFBASE, uefi_lp->FrameBufferBase, uefi_lp->FrameBufferSize);
+  map_addr_early_boot(FBUFFBASE, uefi_lp->FrameBufferBase, uefi_lp->FrameBufferSize, 0);
 }
 
-// Test the stack backtrace function (lab 1 only)
-void
-test_backtrace(int x) {
-  cprintf("entering test_backtrace %d\n", x);
-  if (x > 0)
-    test_backtrace(x - 1);
-  else
-    mon_backtrace(0, 0, 0);
-  cprintf("leaving test_backtrace %d\n", x);
+// Make the SSE registers available to kernel code and, if the CPU
+// has them, the AVX registers as well.  The firmware normally leaves
+// SSE on but does not enable XSAVE.
+static void
+simd_init(void) {
+  uint32_t ecx;
+
+  lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+  cpuid(1, NULL, NULL, &ecx, NULL);
+  if (!(ecx & CPUID_ECX_XSAVE) || !(ecx & CPUID_ECX_AVX))
+    return;
+  lcr4(rcr4() | CR4_OSXSAVE);
+  xsetbv(0, xgetbv(0) | XCR0_X87 | XCR0_SSE | XCR0_AVX);
+}
+
+// Load the kernel PAT layout, in which PTE_WC selects write-combining.
+// Returns false if the CPU has no PAT.
+static bool
+pat_init(void) {
+  uint32_t edx;
+
+  cpuid(1, NULL, NULL, NULL, &edx);
+  if (!(edx & CPUID_EDX_PAT))
+    return false;
+
+  wbinvd();
+  wrmsr(PAT_MSR, PAT_KERNEL);
+  tlbflush();
+  wbinvd();
+  return true;
+}
+
+// Fill the whole framebuffer once and return the rate in MB/s.
+static uint64_t
+fb_fill_rate(void) {
+  uint64_t start = read_tsc();
+
+  memset((void *)FBUFFBASE, 0, uefi_lp->FrameBufferSize);
+  return tsc_rate_mbs(uefi_lp->FrameBufferSize, read_tsc() - start);
+}
+
+// Remap the framebuffer write-combining so that clears and scrolls
+// are not limited by uncached stores.  Reports the fill bandwidth
+// before and after unless the framebuffer output is disabled.
+static void
+fb_map_wc(void) {
+  bool bench = cons_backend_find("fb")->enabled;
+  uint64_t before = 0, after = 0;
+
+  if (!uefi_lp->FrameBufferBase)
+    return;
+  if (!pat_init()) {
+    cprintf("No PAT support, framebuffer is not write-combining\n");
+    return;
+  }
+
+  if (bench)
+    before = fb_fill_rate();
+  map_addr_early_boot(FBUFFBASE, uefi_lp->FrameBufferBase, uefi_lp->FrameBufferSize, PTE_WC);
+  tlbflush_all();
+  if (bench) {
+    after = fb_fill_rate();
+    cprintf("Framebuffer fill: %lu MB/s before, %lu MB/s write-combining\n",
+            (unsigned long)before, (unsigned long)after);
+  }
 }
 
 void
 i386_init(void) {
   extern char end[];
 
+  boot_stamp(BOOT_TSC_INIT);
+
+  // Pick the memcpy/memset variants before the first large copy.
+  simd_init();
+  string_init();
+
+  pmap_init_early();
   early_boot_pml4_init();
+  boot_stamp(BOOT_TSC_PML4);
 
   // Initialize the console.
   // Can't call cprintf until after we do this!
   cons_init();
+  klog_sync();
+  boot_stamp(BOOT_TSC_CONS);
+
+  // W^X for the kernel image if it was linked with KERN_LARGEPAGE=1.
+  pmap_protect_kernel();
+
+  // Physical page allocator, which the early page-table allocator
+  // hands its memory over to, and the slab allocator on top of it.
+  page_init();
+  kmem_init();
+
+  // Console input is interrupt driven; IRQs stay masked by IF
+  // everywhere except while getchar waits for input.
+  trap_init();
+  pic_init();
+
+  tsc_calibrate();
 
   cprintf("6828 decimal is %o octal!\n", 6828);
   cprintf("END: %p\n", end);
@@ -94,15 +158,20 @@ i386_init(void) {
     (*ctor)();
     ctor++;
   }
+  boot_stamp(BOOT_TSC_CTORS);
 
   // Framebuffer init should be done after memory init.
+  fb_map_wc();
   fb_init();
+  boot_stamp(BOOT_TSC_FB);
   cprintf("Framebuffer initialised\n");
 
   // Test the stack backtrace function (lab 1 only)
   test_backtrace(5);
 
-  // Drop into the kernel monitor.
+  // Drop into the kernel monitor.  Console output is deferred from
+  // here on.
+  klog_defer();
   while (1)
     monitor(NULL);
 }
@@ -128,6 +197,9 @@ _panic(const char *file, int line, const char *fmt, ...) {
   // Be extra sure that the machine is in as reasonable state
   __asm __volatile("cli; cld");
 
+  // Bypass the deferred log so the message is not lost.
+  klog_sync();
+
   va_start(ap, fmt);
   cprintf("kernel panic at %s:%d: ", file, line);
   vcprintf(fmt, ap);
@@ -1,6 +1,7 @@
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 #include <inc/dwarf.h>
 #include <inc/elf.h>
 #include <inc/x86.h>
@@ -26,6 +27,12 @@ load_kernel_dwarf_info(struct Dwarf_Addrs *addrs) {
   addrs->pubtypes_end   = (unsigned char *)(uefi_lp->DebugPubtypesEnd);
 }
 
+// The loader leaves the debug sections out on fast boots.
+bool
+debuginfo_available(void) {
+  return uefi_lp->DebugInfoStart != 0;
+}
+
 // debuginfo_rip(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
@@ -47,6 +54,9 @@ debuginfo_rip(uintptr_t addr, struct Ripdebuginfo *info) {
   if (!addr) {
     return 0;
   }
+  if (!debuginfo_available()) {
+    return -E_BAD_DWARF;
+  }
 
   struct Dwarf_Addrs addrs;
   if (addr <= ULIM) {
@@ -91,3 +101,45 @@ debuginfo_rip(uintptr_t addr, struct Ripdebuginfo *info) {
   }
   return 0;
 }
+
+#define SYMCACHE_SIZE 64 // must be a power of 2
+
+static struct Ripsym symcache[SYMCACHE_SIZE];
+
+// Look up the function, file and line of a code address.  The result
+// lives in a small direct-mapped cache, so repeated lookups of the same
+// address (a panic site, a hot trace point) cost one compare.  Failed
+// lookups are cached too.  Returns NULL for addresses that are not in
+// the kernel; the entry's file is NULL if the debug info does not
+// cover the address.
+const struct Ripsym *
+debuginfo_sym(uintptr_t addr) {
+  struct Ripsym *sym = &symcache[((addr * 0x9E3779B97F4A7C15ULL) >> 58) & (SYMCACHE_SIZE - 1)];
+  struct Dwarf_Addrs addrs;
+  Dwarf_Off offset = 0, line_offset = 0;
+  const char *file = NULL, *fn_name = NULL;
+  uintptr_t fn_addr = 0;
+  int line          = 0;
+
+  if (addr <= ULIM)
+    return NULL;
+  if (sym->rip == addr)
+    return sym;
+
+  load_kernel_dwarf_info(&addrs);
+  if (addrs.info_begin &&
+      info_by_address(&addrs, addr, &offset) >= 0 &&
+      file_name_by_info(&addrs, offset, (char *)&file, sizeof(file), &line_offset) >= 0 &&
+      function_by_info(&addrs, addr, offset, (char *)&fn_name, sizeof(fn_name), &fn_addr) >= 0) {
+    if (line_for_address(&addrs, addr, line_offset, &line) < 0)
+      line = 0;
+  } else
+    file = NULL;
+
+  sym->rip     = addr;
+  sym->file    = file;
+  sym->fn_name = fn_name;
+  sym->fn_addr = fn_addr;
+  sym->line    = line;
+  return sym;
+}
@@ -15,6 +15,19 @@ struct Ripdebuginfo {
   int rip_fn_narg;       // Number of function arguments
 };
 
+bool debuginfo_available(void);
 int debuginfo_rip(uintptr_t eip, struct Ripdebuginfo *info);
 
+// Cached symbol lookup result.  The strings point into the
+// kernel's DWARF sections and are not copied.
+struct Ripsym {
+  uintptr_t rip;
+  const char *file;    // NULL if the address was not found
+  const char *fn_name; // null terminated
+  uintptr_t fn_addr;
+  int line;
+};
+
+const struct Ripsym *debuginfo_sym(uintptr_t addr);
+
 #endif
@@ -0,0 +1,162 @@
+// Kernel log ring buffer with deferred console drain.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/console.h>
+#include <kern/klog.h>
+
+struct klog_record {
+  // Sequence number plus one once the record is committed,
+  // zero while a writer is still filling it in.
+  volatile uint64_t seq;
+  uint64_t tsc;
+  uint32_t len;
+  char text[KLOG_TEXTSIZE];
+};
+
+static struct klog_record klog_ring[KLOG_NRECORDS];
+
+static volatile uint64_t klog_head; // next sequence number to reserve
+static uint64_t klog_tail;          // next sequence number to drain
+static uint64_t klog_lost;          // records overwritten before drain
+static volatile uint32_t klog_busy; // set while a drain is running
+static bool klog_synchronous;
+
+// Append text to the log.  Long writes are split into several records.
+// Only the copy happens here unless the log is in synchronous mode
+// or more than half of it is waiting to be drained.
+void
+klog_write(const char *s, size_t n) {
+  while (n > 0) {
+    size_t len   = MIN(n, (size_t)KLOG_TEXTSIZE);
+    uint64_t seq = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    struct klog_record *rec = &klog_ring[seq & (KLOG_NRECORDS - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->tsc = read_tsc();
+    rec->len = len;
+    memcpy(rec->text, s, len);
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+
+    s += len;
+    n -= len;
+  }
+
+  if (klog_synchronous || klog_head - klog_tail > KLOG_NRECORDS / 2)
+    klog_drain();
+}
+
+// Push every committed record to the console backends in order.
+// Stops at the first record that is still being written.
+void
+klog_drain(void) {
+  char text[KLOG_TEXTSIZE];
+
+  if (xchg(&klog_busy, 1))
+    return;
+
+  while (klog_tail != klog_head) {
+    uint64_t head = klog_head;
+    if (head - klog_tail > KLOG_NRECORDS) {
+      klog_lost += head - klog_tail - KLOG_NRECORDS;
+      klog_tail = head - KLOG_NRECORDS;
+    }
+
+    struct klog_record *rec = &klog_ring[klog_tail & (KLOG_NRECORDS - 1)];
+    uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    if (seq < klog_tail + 1)
+      break; // not committed yet
+
+    uint32_t len = MIN(rec->len, (uint32_t)KLOG_TEXTSIZE);
+    memcpy(text, rec->text, len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq != klog_tail + 1 || rec->seq != seq) {
+      // A writer lapped us while we were copying.
+      klog_lost++;
+      klog_tail++;
+      continue;
+    }
+
+    klog_tail++;
+    cons_write(text, len);
+  }
+
+  xchg(&klog_busy, 0);
+}
+
+// Switch to synchronous mode: flush what is pending and write every
+// further record through immediately.  Used during boot, once the
+// console is up, and by _panic, which may be called with a drain
+// already in progress.
+void
+klog_sync(void) {
+  klog_synchronous = true;
+  xchg(&klog_busy, 0);
+  klog_drain();
+}
+
+// Leave synchronous mode once the system is up: from then on records
+// wait for the next drain unless half of the log fills up.
+void
+klog_defer(void) {
+  klog_drain();
+  klog_synchronous = false;
+}
+
+static void
+klog_out(struct cons_backend *out, const char *s, size_t n) {
+  if (out)
+    cons_backend_write(out, s, n);
+  else
+    cons_write(s, n);
+}
+
+// Print the records still held in the ring, each line prefixed
+// with the TSC value of the record it starts in.  Output goes to
+// the given console backend only, or to all enabled ones if NULL.
+void
+klog_dump(struct cons_backend *out) {
+  char text[KLOG_TEXTSIZE];
+  char prefix[32];
+  bool bol = true;
+  uint64_t head, seq;
+
+  klog_drain();
+
+  head = klog_head;
+  seq  = head > KLOG_NRECORDS ? head - KLOG_NRECORDS : 0;
+  for (; seq < head; seq++) {
+    struct klog_record *rec = &klog_ring[seq & (KLOG_NRECORDS - 1)];
+    uint64_t tsc;
+    uint32_t len, i, start;
+
+    if (rec->seq != seq + 1)
+      continue;
+    tsc = rec->tsc;
+    len = MIN(rec->len, (uint32_t)KLOG_TEXTSIZE);
+    memcpy(text, rec->text, len);
+    if (rec->seq != seq + 1)
+      continue;
+
+    for (i = start = 0; i < len; i++) {
+      if (bol) {
+        klog_out(out, prefix, snprintf(prefix, sizeof(prefix), "[%16lu] ", (unsigned long)tsc));
+        bol = false;
+      }
+      if (text[i] == '\n') {
+        klog_out(out, text + start, i + 1 - start);
+        start = i + 1;
+        bol   = true;
+      }
+    }
+    klog_out(out, text + start, len - start);
+  }
+  if (!bol)
+    klog_out(out, "\n", 1);
+  if (klog_lost)
+    klog_out(out, prefix, snprintf(prefix, sizeof(prefix), "%lu records lost\n", (unsigned long)klog_lost));
+}
@@ -0,0 +1,30 @@
+#ifndef JOS_KERN_KLOG_H
+#define JOS_KERN_KLOG_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Kernel log ring buffer.
+//
+// cprintf output is appended to a fixed-size array of sequence-numbered
+// records instead of being written to the console devices directly.
+// Writers only reserve a slot with an atomic increment and copy their text,
+// so klog_write() is safe to call from interrupt context.  Records are
+// pushed to the console later by klog_drain().  During boot, from
+// cons_init() until the monitor starts, every record is written through
+// at once so that a hang leaves the last messages on the console.
+
+#define KLOG_NRECORDS 256 // must be a power of 2
+#define KLOG_TEXTSIZE 112 // bytes of text per record
+
+struct cons_backend;
+
+void klog_write(const char *s, size_t n);
+void klog_drain(void);
+void klog_sync(void);
+void klog_defer(void);
+void klog_dump(struct cons_backend *out);
+
+#endif // !JOS_KERN_KLOG_H
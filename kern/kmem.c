@@ -0,0 +1,435 @@
+// Slab allocator and kmalloc on top of the page allocator.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/kmem.h>
+
+// Header at the start of every slab.
+struct kmem_slab {
+  struct kmem_slab *next; // on one of the cache's slab lists
+  struct kmem_slab *prev;
+  struct kmem_cache *cache;
+  char *objs;             // first object, after the color offset
+  void *free;             // first free object
+  size_t inuse;
+};
+
+// A slab is worth its size once it holds this many objects or wastes
+// at most 1/8 of itself.
+#define KMEM_MIN_PERSLAB 8
+
+#define KMALLOC_NCLASSES 9 // 8 .. 2048 bytes
+
+static struct kmem_cache kmem_cache_cache; // caches for kmem_cache_create
+static struct kmem_cache *kmem_caches;
+static struct kmem_cache *kmalloc_caches[KMALLOC_NCLASSES];
+static size_t kmalloc_nlarge; // page allocator blocks handed out by kmalloc
+
+static void
+slab_push(struct kmem_slab **head, struct kmem_slab *slab) {
+  slab->prev = NULL;
+  slab->next = *head;
+  if (slab->next)
+    slab->next->prev = slab;
+  *head = slab;
+}
+
+static void
+slab_remove(struct kmem_slab **head, struct kmem_slab *slab) {
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *head = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+}
+
+static inline void **
+obj_freeptr(struct kmem_cache *cp, void *obj) {
+  return (void **)((char *)obj + cp->freeptr);
+}
+
+static size_t
+slab_header_size(struct kmem_cache *cp) {
+  return ROUNDUP(sizeof(struct kmem_slab), cp->align);
+}
+
+static size_t
+color_step(struct kmem_cache *cp) {
+  return MAX(cp->align, (size_t)KMEM_LINE);
+}
+
+// Fill in a cache for objects of 'size' bytes aligned to 'align', a
+// power of two or 0 for pointer alignment.  Picks the smallest slab
+// that holds KMEM_MIN_PERSLAB objects or wastes little, and uses the
+// space a slab would waste anyway for coloring.  Returns false if the
+// arguments are bad or the objects do not fit in the largest slab.
+static bool
+kmem_cache_setup(struct kmem_cache *cp, const char *name, size_t size,
+                 size_t align, void (*ctor)(void *)) {
+  size_t slabsize, hdr, waste = 0;
+
+  if (!align)
+    align = sizeof(void *);
+  if (!size || (align & (align - 1)) || align > PGSIZE)
+    return false;
+
+  memset(cp, 0, sizeof(*cp));
+  strlcpy(cp->name, name, sizeof(cp->name));
+  cp->size  = size;
+  cp->align = MAX(align, sizeof(void *));
+  cp->ctor  = ctor;
+
+  // A constructed object must keep its contents while it is free, so
+  // with a constructor the free list link goes after the object.
+  if (ctor) {
+    cp->freeptr = ROUNDUP(size, sizeof(void *));
+    cp->objsize = ROUNDUP(cp->freeptr + sizeof(void *), cp->align);
+  } else {
+    cp->freeptr = 0;
+    cp->objsize = ROUNDUP(MAX(size, sizeof(void *)), cp->align);
+  }
+
+  hdr = slab_header_size(cp);
+  for (cp->order = 0; cp->order <= KMEM_MAX_ORDER; cp->order++) {
+    slabsize = PGSIZE << cp->order;
+    if (slabsize < hdr + cp->objsize)
+      continue;
+    cp->perslab = (slabsize - hdr) / cp->objsize;
+    waste       = slabsize - hdr - cp->perslab * cp->objsize;
+    if (cp->perslab >= KMEM_MIN_PERSLAB || waste * 8 <= slabsize)
+      break;
+  }
+  if (!cp->perslab)
+    return false;
+  if (cp->order > KMEM_MAX_ORDER)
+    cp->order = KMEM_MAX_ORDER;
+
+  cp->ncolors = waste / color_step(cp) + 1;
+
+  struct kmem_cache **pcp = &kmem_caches;
+  while (*pcp)
+    pcp = &(*pcp)->next;
+  *pcp = cp;
+  return true;
+}
+
+// Take a block from the page allocator for a new slab of 'cp', give
+// it the next color and build its free list, constructing every object.
+static struct kmem_slab *
+kmem_slab_create(struct kmem_cache *cp) {
+  struct PageInfo *pp = page_alloc_order(cp->order, 0);
+  struct kmem_slab *slab;
+  size_t i;
+  char *obj;
+
+  if (!pp)
+    return NULL;
+
+  slab = page2kva(pp);
+  for (i = 0; i < (1UL << cp->order); i++)
+    pp[i].pp_slab = slab;
+
+  slab->cache = cp;
+  slab->inuse = 0;
+  slab->objs  = (char *)slab + slab_header_size(cp) + cp->color_next * color_step(cp);
+  if (++cp->color_next == cp->ncolors)
+    cp->color_next = 0;
+
+  slab->free = NULL;
+  for (i = cp->perslab; i-- > 0;) {
+    obj = slab->objs + i * cp->objsize;
+    if (cp->ctor)
+      cp->ctor(obj);
+    *obj_freeptr(cp, obj) = slab->free;
+    slab->free = obj;
+  }
+
+  cp->nslabs++;
+  return slab;
+}
+
+static void
+kmem_slab_destroy(struct kmem_cache *cp, struct kmem_slab *slab) {
+  struct PageInfo *pp = pa2page(PADDR(slab));
+  size_t i;
+
+  for (i = 0; i < (1UL << cp->order); i++)
+    pp[i].pp_slab = NULL;
+  page_free_order(pp, cp->order);
+  cp->nslabs--;
+}
+
+// Allocate an object from 'cp'.  Partially used slabs are drained
+// first so that empty ones can go back to the page allocator.
+// Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct kmem_cache *cp) {
+  struct kmem_slab *slab = cp->partial;
+  void *obj;
+
+  if (!slab) {
+    if ((slab = cp->empty) != NULL)
+      cp->empty = NULL;
+    else if ((slab = kmem_slab_create(cp)) == NULL) {
+      cp->nfail++;
+      return NULL;
+    }
+    slab_push(&cp->partial, slab);
+  }
+
+  obj        = slab->free;
+  slab->free = *obj_freeptr(cp, obj);
+  slab->inuse++;
+  if (!slab->free) {
+    slab_remove(&cp->partial, slab);
+    slab_push(&cp->full, slab);
+  }
+
+  cp->nalloc++;
+  cp->active++;
+  return obj;
+}
+
+// Return an object to 'cp'.  A slab that becomes empty is kept if the
+// cache has no other empty slab and freed to the page allocator otherwise.
+void
+kmem_cache_free(struct kmem_cache *cp, void *obj) {
+  struct kmem_slab *slab = pa2page(PADDR(obj))->pp_slab;
+
+  if (!slab || slab->cache != cp || (char *)obj < slab->objs ||
+      (char *)obj >= slab->objs + cp->perslab * cp->objsize ||
+      ((char *)obj - slab->objs) % cp->objsize)
+    panic("kmem_cache_free: %p is not a %s object", obj, cp->name);
+  if (!slab->inuse)
+    panic("kmem_cache_free: %p freed twice", obj);
+
+  if (!slab->free) {
+    slab_remove(&cp->full, slab);
+    slab_push(&cp->partial, slab);
+  }
+  *obj_freeptr(cp, obj) = slab->free;
+  slab->free = obj;
+  cp->nfree++;
+  cp->active--;
+
+  if (--slab->inuse == 0) {
+    slab_remove(&cp->partial, slab);
+    if (!cp->empty)
+      cp->empty = slab;
+    else
+      kmem_slab_destroy(cp, slab);
+  }
+}
+
+// Create a cache for objects of 'size' bytes.  'ctor', if not NULL,
+// is called on each object once when its slab is created.  Returns
+// NULL if the size or alignment is not supported or out of memory.
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *)) {
+  struct kmem_cache *cp = kmem_cache_alloc(&kmem_cache_cache);
+
+  if (!cp)
+    return NULL;
+  if (!kmem_cache_setup(cp, name, size, align, ctor)) {
+    kmem_cache_free(&kmem_cache_cache, cp);
+    return NULL;
+  }
+  return cp;
+}
+
+// Destroy a cache with no objects allocated from it.
+void
+kmem_cache_destroy(struct kmem_cache *cp) {
+  struct kmem_cache **pcp;
+
+  if (cp->active || cp->partial || cp->full)
+    panic("kmem_cache_destroy: %s still has objects", cp->name);
+  if (cp->empty)
+    kmem_slab_destroy(cp, cp->empty);
+
+  for (pcp = &kmem_caches; *pcp != cp; pcp = &(*pcp)->next)
+    ;
+  *pcp = cp->next;
+  kmem_cache_free(&kmem_cache_cache, cp);
+}
+
+#define CHECK_PATTERN 0x5a
+#define CHECK_SIZE    96 // leaves room for two colors
+
+static int check_nctor;
+
+static void
+check_ctor(void *obj) {
+  memset(obj, CHECK_PATTERN, CHECK_SIZE);
+  check_nctor++;
+}
+
+static void
+check_constructed(void *obj) {
+  size_t i;
+
+  for (i = 0; i < CHECK_SIZE; i++)
+    assert(((unsigned char *)obj)[i] == CHECK_PATTERN);
+}
+
+// Exercise a cache with a constructor: the constructor runs once per
+// object when a slab is made and the free list link does not clobber
+// constructed objects; slabs move between the partial, full and empty
+// lists; and each new slab starts its objects at the next color.
+static void
+check_kmem_cache(void) {
+  static void *objs[3 * PGSIZE / CHECK_SIZE];
+  struct kmem_cache *cp = kmem_cache_create("check", CHECK_SIZE, 0, check_ctor);
+  size_t hdr, i, n, slabs = 0;
+  uintptr_t off;
+
+  assert(cp && cp->freeptr >= CHECK_SIZE && cp->objsize >= cp->freeptr + sizeof(void *));
+  assert(cp->ncolors > 1);
+  hdr = slab_header_size(cp);
+  n   = MIN(3 * cp->perslab, sizeof(objs) / sizeof(objs[0]));
+
+  for (i = 0; i < n; i++) {
+    assert((objs[i] = kmem_cache_alloc(cp)) != NULL);
+    check_constructed(objs[i]);
+    if (cp->nslabs > slabs) {
+      // First object of a new slab.
+      off = (uintptr_t)objs[i] & ((PGSIZE << cp->order) - 1);
+      assert(off == hdr + (slabs % cp->ncolors) * color_step(cp));
+      slabs = cp->nslabs;
+    }
+    if (i + 1 == cp->perslab)
+      assert(!cp->partial && cp->full && !cp->empty);
+  }
+  assert(check_nctor == (int)(cp->nslabs * cp->perslab));
+  assert(cp->active == n);
+
+  kmem_cache_free(cp, objs[0]);
+  assert(cp->partial && cp->partial->free == objs[0]);
+  objs[0] = kmem_cache_alloc(cp);
+  check_constructed(objs[0]);
+
+  for (i = 0; i < n; i++) {
+    kmem_cache_free(cp, objs[i]);
+    check_constructed(objs[i]);
+  }
+  assert(!cp->partial && !cp->full && cp->empty && cp->nslabs == 1 && !cp->active);
+
+  kmem_cache_destroy(cp);
+}
+
+// kmalloc must pick the smallest class that fits, align to the class
+// size up to KMEM_LINE, and return large blocks to the page allocator.
+static void
+check_kmalloc(void) {
+  static const size_t sizes[] = {1, 8, 9, 16, 17, 100, 512, 513, 2047, 2048,
+                                 2049, PGSIZE, PGSIZE + 1, 5 * PGSIZE};
+  struct PageInfo *pp;
+  size_t i, class;
+  void *p;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    assert((p = kmalloc(sizes[i])) != NULL);
+    memset(p, 0, sizes[i]);
+    pp = pa2page(PADDR(p));
+    if (sizes[i] <= KMALLOC_MAX) {
+      for (class = KMALLOC_MIN; class < sizes[i]; class <<= 1)
+        ;
+      assert(pp->pp_slab && ((struct kmem_slab *)pp->pp_slab)->cache->size == class);
+      assert((uintptr_t)p % MIN(class, (size_t)KMEM_LINE) == 0);
+    } else {
+      assert(!pp->pp_slab && (PGSIZE << pp->pp_order) >= sizes[i]);
+      assert(pp->pp_order == 0 || (PGSIZE << (pp->pp_order - 1)) < sizes[i]);
+      assert(PADDR(p) % (PGSIZE << pp->pp_order) == 0);
+    }
+    kfree(p);
+  }
+  assert(kmalloc(0) == NULL);
+  assert(kmalloc_nlarge == 0);
+}
+
+// Set up the cache of caches and the kmalloc size classes.
+// Needs page_init().
+void
+kmem_init(void) {
+  char name[KMEM_NAMELEN];
+  size_t size;
+  int i;
+
+  if (!kmem_cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL))
+    panic("kmem_init: cannot set up the cache of caches");
+
+  for (i = 0, size = KMALLOC_MIN; size <= KMALLOC_MAX; i++, size <<= 1) {
+    snprintf(name, sizeof(name), "kmalloc-%lu", (unsigned long)size);
+    if (!(kmalloc_caches[i] = kmem_cache_create(name, size, MIN(size, (size_t)KMEM_LINE), NULL)))
+      panic("kmem_init: cannot create %s", name);
+  }
+
+  check_kmem_cache();
+  check_kmalloc();
+  cprintf("check_kmem() succeeded!\n");
+}
+
+// Allocate 'size' bytes from the smallest size class that fits, or
+// a block of pages from the page allocator for sizes above KMALLOC_MAX.
+// Blocks of a size class are aligned to that size up to KMEM_LINE.
+void *
+kmalloc(size_t size) {
+  struct PageInfo *pp;
+  int order;
+
+  if (!size)
+    return NULL;
+  if (size <= KMALLOC_MIN)
+    return kmem_cache_alloc(kmalloc_caches[0]);
+  if (size <= KMALLOC_MAX)
+    return kmem_cache_alloc(kmalloc_caches[64 - __builtin_clzll(size - 1) - 3]);
+
+  for (order = 0; order <= PAGE_MAX_ORDER && (PGSIZE << order) < size; order++)
+    ;
+  if (order > PAGE_MAX_ORDER || (pp = page_alloc_order(order, 0)) == NULL)
+    return NULL;
+  pp->pp_order = order;
+  kmalloc_nlarge++;
+  return page2kva(pp);
+}
+
+void
+kfree(void *ptr) {
+  struct PageInfo *pp;
+  struct kmem_slab *slab;
+
+  if (!ptr)
+    return;
+
+  pp = pa2page(PADDR(ptr));
+  if ((slab = pp->pp_slab) != NULL) {
+    kmem_cache_free(slab->cache, ptr);
+    return;
+  }
+
+  if (PGOFF(ptr) || pp->pp_order > PAGE_MAX_ORDER)
+    panic("kfree: %p was not allocated by kmalloc", ptr);
+  page_free_order(pp, pp->pp_order);
+  kmalloc_nlarge--;
+}
+
+// Print the statistics of every cache.
+void
+kmem_stats(void) {
+  struct kmem_cache *cp;
+
+  cprintf("%-16s %6s %6s %5s %7s %6s %6s %8s %10s %10s %6s\n", "cache", "size", "obj",
+          "order", "perslab", "colors", "slabs", "active", "allocs", "frees", "fails");
+  for (cp = kmem_caches; cp; cp = cp->next)
+    cprintf("%-16s %6lu %6lu %5d %7lu %6lu %6lu %8lu %10lu %10lu %6lu\n", cp->name,
+            (unsigned long)cp->size, (unsigned long)cp->objsize, cp->order,
+            (unsigned long)cp->perslab, (unsigned long)cp->ncolors, (unsigned long)cp->nslabs,
+            (unsigned long)cp->active, (unsigned long)cp->nalloc, (unsigned long)cp->nfree,
+            (unsigned long)cp->nfail);
+  cprintf("kmalloc page blocks in use: %lu\n", (unsigned long)kmalloc_nlarge);
+}
@@ -0,0 +1,70 @@
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Slab allocator for fixed-size kernel objects.
+//
+// Each cache hands out objects of one size from slabs, blocks of
+// 2^order pages from the page allocator that start with a struct
+// kmem_slab header.  Free objects are linked through a pointer kept
+// in the object itself.  Slabs start their objects at different
+// cache-line offsets ("colors") so that the objects at the same index
+// of different slabs do not all fall into the same cache sets.
+//
+// A constructor, if given, runs once for every object when its slab is
+// created, not on every allocation: objects must be returned to
+// kmem_cache_free() in their constructed state.
+
+#define KMEM_LINE      64 // cache line size, the coloring step
+#define KMEM_MAX_ORDER 3  // largest slab, in page allocator orders
+#define KMEM_NAMELEN   16
+
+// kmalloc size classes are the powers of two in [KMALLOC_MIN, KMALLOC_MAX];
+// larger requests get whole blocks from the page allocator.
+#define KMALLOC_MIN 8
+#define KMALLOC_MAX 2048
+
+struct kmem_slab;
+
+struct kmem_cache {
+  char name[KMEM_NAMELEN];
+  size_t size;       // object size as requested
+  size_t objsize;    // distance between objects in a slab
+  size_t freeptr;    // offset of the free list link in an object
+  size_t align;
+  void (*ctor)(void *obj);
+
+  int order;         // slab size is PGSIZE << order
+  size_t perslab;    // objects per slab
+  size_t ncolors;    // number of different object offsets
+  size_t color_next; // color of the next slab created
+
+  struct kmem_slab *partial; // slabs with both free and used objects
+  struct kmem_slab *full;    // slabs with no free objects
+  struct kmem_slab *empty;   // one slab kept back with no used objects
+
+  // Statistics.
+  uint64_t nalloc;   // successful allocations
+  uint64_t nfree;    // frees
+  uint64_t nfail;    // allocations that found no memory
+  size_t nslabs;     // slabs currently held
+  size_t active;     // objects currently allocated
+
+  struct kmem_cache *next; // all caches
+};
+
+void kmem_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *));
+void *kmem_cache_alloc(struct kmem_cache *cp);
+void kmem_cache_free(struct kmem_cache *cp, void *obj);
+void kmem_cache_destroy(struct kmem_cache *cp);
+void kmem_stats(void);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+#endif // !JOS_KERN_KMEM_H
@@ -10,6 +10,11 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/klog.h>
+#include <kern/binlog.h>
+#include <kern/boottime.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
 
 #define CMDBUF_SIZE 80 // enough for one VGA text line
 
@@ -25,7 +30,14 @@ static struct Command commands[] = {
     {"hello", "Display greeting message", mon_hello},
     {"kerninfo", "Display information about the kernel", mon_kerninfo},
     {"backtrace", "Print stack backtrace", mon_backtrace},
-    {"name", "Print developer name", mon_name}};
+    {"name", "Print developer name", mon_name},
+    {"dmesg", "Dump the kernel log buffer [to one output]", mon_dmesg},
+    {"console", "List console outputs or turn one on/off", mon_console},
+    {"binlog", "Format new binary trace records [or all]", mon_binlog},
+    {"boottime", "Show time spent in each boot phase", mon_boottime},
+    {"cr3bench", "Measure CR3 switch cost with global pages and PCIDs", mon_cr3bench},
+    {"pages", "Show free physical memory by block size", mon_pages},
+    {"kmem", "Show slab cache statistics", mon_kmem}};
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -89,14 +101,12 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf) {
   uint64_t *rbp = (uint64_t *)read_rbp();
   uint64_t rip  = rbp[1];
 
-  struct Ripdebuginfo info;
-  
   while (rbp != 0x0 && rip != 0x0) {
-    cprintf("  rbp %015lx rip %015lx\n", (uint64_t)rbp, rip);
-    debuginfo_rip(rip, &info);
-    
-    cprintf("       %s:%d ", info.rip_file, info.rip_line);
-    cprintf("%.*s+%lu\n", info.rip_fn_namelen, info.rip_fn_name, rip - info.rip_fn_addr);
+    // Without debug info the raw addresses are all we have.
+    if (debuginfo_available())
+      cprintf("  rbp %015lx rip %015lx %pB\n", (unsigned long)rbp, (unsigned long)rip, (void *)rip);
+    else
+      cprintf("  rbp %015lx rip %015lx\n", (unsigned long)rbp, (unsigned long)rip);
     rbp = (uint64_t*)rbp[0];
     rip = rbp[1];
   }
@@ -104,6 +114,76 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf) {
   return 0;
 }
 
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf) {
+  struct cons_backend *out = NULL;
+
+  // 'dmesg debugcon' sends a long log to the fast debug port only.
+  if (argc > 1 && ((out = cons_backend_find(argv[1])) == NULL || !out->present)) {
+    cprintf("No console output '%s'\n", argv[1]);
+    return 0;
+  }
+  klog_dump(out);
+  return 0;
+}
+
+int
+mon_console(int argc, char **argv, struct Trapframe *tf) {
+  struct cons_backend *b;
+  int i;
+
+  if (argc == 1) {
+    for (i = 0; (b = cons_backend_at(i)) != NULL; i++)
+      cprintf("  %-8s %s\n", b->name,
+              !b->present ? "absent" : b->enabled ? "on" : "off");
+    return 0;
+  }
+
+  if (argc != 3 || (strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0)) {
+    cprintf("Usage: console [<output> on|off]\n");
+    return 0;
+  }
+  // Flush pending output so it still goes to the old set of outputs.
+  klog_drain();
+  if (cons_backend_enable(argv[1], strcmp(argv[2], "on") == 0) < 0)
+    cprintf("No console output '%s'\n", argv[1]);
+  return 0;
+}
+
+int
+mon_binlog(int argc, char **argv, struct Trapframe *tf) {
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "all") != 0)) {
+    cprintf("Usage: binlog [all]\n");
+    return 0;
+  }
+  binlog_dump(argc == 2);
+  return 0;
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf) {
+  boottime_print();
+  return 0;
+}
+
+int
+mon_cr3bench(int argc, char **argv, struct Trapframe *tf) {
+  pmap_cr3_bench();
+  return 0;
+}
+
+int
+mon_pages(int argc, char **argv, struct Trapframe *tf) {
+  page_stats();
+  return 0;
+}
+
+int
+mon_kmem(int argc, char **argv, struct Trapframe *tf) {
+  kmem_stats();
+  return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -155,6 +235,8 @@ monitor(struct Trapframe *tf) {
   cprintf("Type 'help' for a list of commands.\n");
 
   while (1) {
+    // Flush deferred log output before blocking for input.
+    klog_drain();
     buf = readline("K> ");
     if (buf != NULL)
       if (runcmd(buf, tf) < 0)
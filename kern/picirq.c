@@ -0,0 +1,105 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/trap.h>
+
+#include <kern/picirq.h>
+
+// Current IRQ mask.
+// Initial IRQ mask has interrupt 2 enabled (for slave 8259A).
+uint16_t irq_mask_8259A = 0xFFFF & ~(1 << IRQ_SLAVE);
+static bool didinit;
+
+/* Initialize the 8259A interrupt controllers. */
+void
+pic_init(void) {
+  didinit = 1;
+
+  // mask all interrupts
+  outb(IO_PIC1 + 1, 0xFF);
+  outb(IO_PIC2 + 1, 0xFF);
+
+  // Set up master (8259A-1)
+
+  // ICW1:  0001g0hi
+  //    g:  0 = edge triggering, 1 = level triggering
+  //    h:  0 = cascaded PICs, 1 = master only
+  //    i:  0 = no ICW4, 1 = ICW4 required
+  outb(IO_PIC1, 0x11);
+
+  // ICW2:  Vector offset
+  outb(IO_PIC1 + 1, IRQ_OFFSET);
+
+  // ICW3:  bit mask of IR lines connected to slave PICs (master PIC),
+  //        3-bit No of IR line at which slave connects to master(slave PIC).
+  outb(IO_PIC1 + 1, 1 << IRQ_SLAVE);
+
+  // ICW4:  000nbmap
+  //    n:  1 = special fully nested mode
+  //    b:  1 = buffered mode
+  //    m:  0 = slave PIC, 1 = master PIC
+  //	  (ignored when b is 0, as the master/slave role
+  //	  can be hardwired).
+  //    a:  1 = Automatic EOI mode
+  //    p:  0 = MCS-80/85 mode, 1 = intel x86 mode
+  outb(IO_PIC1 + 1, 0x1);
+
+  // Set up slave (8259A-2)
+  outb(IO_PIC2, 0x11);               // ICW1
+  outb(IO_PIC2 + 1, IRQ_OFFSET + 8); // ICW2
+  outb(IO_PIC2 + 1, IRQ_SLAVE);      // ICW3
+  // NB Automatic EOI mode doesn't tend to work on the slave.
+  // Linux source code says it's "to be investigated".
+  outb(IO_PIC2 + 1, 0x01); // ICW4
+
+  // OCW3:  0ef01prs
+  //   ef:  0x = NOP, 10 = clear specific mask, 11 = set specific mask
+  //    p:  0 = no polling, 1 = polling mode
+  //   rs:  0x = NOP, 10 = read IRR, 11 = read ISR
+  outb(IO_PIC1, 0x68); /* clear specific mask */
+  outb(IO_PIC1, 0x0a); /* read IRR by default */
+
+  outb(IO_PIC2, 0x68); /* OCW3 */
+  outb(IO_PIC2, 0x0a); /* OCW3 */
+
+  if (irq_mask_8259A != 0xFFFF)
+    irq_setmask_8259A(irq_mask_8259A);
+}
+
+void
+irq_setmask_8259A(uint16_t mask) {
+  irq_mask_8259A = mask;
+  if (!didinit)
+    return;
+  outb(IO_PIC1 + 1, (char)mask);
+  outb(IO_PIC2 + 1, (char)(mask >> 8));
+}
+
+// Whether 'irq' can reach the CPU once interrupts are enabled.
+bool
+irq_enabled(uint8_t irq) {
+  return didinit && !(irq_mask_8259A & (1 << irq));
+}
+
+// Whether 'irq', the lowest priority line of one of the PICs, was
+// raised spuriously: its request went away before the CPU acknowledged
+// it, and then the PIC reports IRQ 7 or 15 without setting the line's
+// ISR bit.  Reads the ISR with OCW3 and switches back to the IRR.
+bool
+pic_spurious(uint8_t irq) {
+  int port = irq >= 8 ? IO_PIC2 : IO_PIC1;
+  uint8_t isr;
+
+  if ((irq & 7) != 7)
+    return false;
+  outb(port, 0x0b);
+  isr = inb(port);
+  outb(port, 0x0a);
+  return !(isr & 0x80);
+}
+
+void
+pic_send_eoi(uint8_t irq) {
+  if (irq >= 8)
+    outb(IO_PIC2, 0x20);
+  outb(IO_PIC1, 0x20);
+}
@@ -0,0 +1,662 @@
+// Early boot page mapping on top of the tables built by bootstrap.S.
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/uefi.h>
+
+#include <kern/pmap.h>
+
+// Physical address in a 2MB or 1GB page entry, whose bit 12 is PTE_PAT_LARGE.
+#define LARGE_ADDR(e, size) ((e) & 0x000FFFFFFFFFF000ULL & ~((uint64_t)(size)-1))
+
+// Attribute bits that select the memory type and access rights of a large page.
+#define LARGE_ATTR_BITS (PTE_W | PTE_PWT | PTE_PCD | PTE_PAT_LARGE | PTE_NX)
+
+// Physical memory is mapped at KERNBASE up to UVPT.
+#define DIRECTMAP_LIMIT (UVPT - KERNBASE)
+
+#define CR3_BENCH_ROUNDS 10000
+#define CR3_BENCH_PAGES  32 // each of kernel and identity mapped pages
+
+bool pmap_1g_pages;
+bool pmap_pcid;
+
+static uint64_t pcid_gen = 1; // bumped when the PCIDs are handed out again
+static uint16_t pcid_next = 1;
+
+// Memory map ranges the early allocator has taken pages from.  The
+// last one is the range it is currently bumping through up to boot_limit.
+static struct boot_range boot_ranges[BOOT_ALLOC_MAXRANGES];
+static size_t boot_nranges;
+static physaddr_t boot_limit;
+static bool boot_closed;
+// Early page-table pages must be reachable through the identity map
+// bootstrap.S builds, which covers the first GB, until page_init()
+// maps the rest of memory.
+static physaddr_t boot_alloc_limit = PDPSIZE;
+static bool pmap_direct;
+
+struct PageInfo *pages;
+size_t npages;
+
+// Buddy allocator state.  Free blocks of order k are 2^k pages with the
+// first page number a multiple of 2^k.  Each order has a list of its
+// free blocks linked through pp_link/pp_prev, and a bitmap with one bit
+// per possible block telling whether the block is free, so that finding
+// out if a buddy can be merged does not need a list walk.  Bit k of
+// page_free_orders is set while list k is not empty.
+static struct PageInfo *page_free_list[PAGE_NORDERS];
+static uint64_t *page_free_map[PAGE_NORDERS];
+static size_t page_free_blocks[PAGE_NORDERS];
+static uint32_t page_free_orders;
+
+// Check for 1GB page support.  bootstrap.S makes the same check and
+// maps KERNBASE with 1GB pages, which leaves its two page directories
+// free for alloc_pde_early_boot().  Also turn on global pages, so that
+// the PTE_G kernel mappings survive CR3 loads, and PCIDs if the CPU
+// has them.
+void
+pmap_init_early(void) {
+  uint32_t ecx, edx;
+
+  cpuid(0x80000001, NULL, NULL, NULL, &edx);
+  pmap_1g_pages = (edx & CPUID_EXT_EDX_PDPE1GB) != 0;
+
+  lcr4(rcr4() | CR4_PGE);
+
+  // The current CR3 has PCID 0, as CR4.PCIDE requires.
+  cpuid(1, NULL, NULL, &ecx, NULL);
+  if (ecx & CPUID_ECX_PCID) {
+    lcr4(rcr4() | CR4_PCIDE);
+    pmap_pcid = true;
+  }
+}
+
+// Flush the whole TLB, global entries and all PCIDs included.
+void
+tlbflush_all(void) {
+  uint64_t cr4 = rcr4();
+
+  if (cr4 & CR4_PGE) {
+    lcr4(cr4 & ~CR4_PGE);
+    lcr4(cr4);
+  } else
+    tlbflush();
+}
+
+// Kernel-half mappings are the same in every address space.
+static uint64_t
+global_bit(uintptr_t va) {
+  return va >= ULIM ? PTE_G : 0;
+}
+
+// Find the lowest EFI conventional memory range above 'from' and
+// below boot_alloc_limit.  Returns false if there is none.
+static bool
+boot_next_range(physaddr_t from, physaddr_t *start, physaddr_t *end) {
+  EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)uefi_lp->MemoryMap;
+  EFI_MEMORY_DESCRIPTOR *desc_end = (EFI_MEMORY_DESCRIPTOR *)(uefi_lp->MemoryMap + uefi_lp->MemoryMapSize);
+  physaddr_t s, e;
+  bool found = false;
+
+  for (; desc < desc_end; desc = (void *)desc + uefi_lp->MemoryMapDescriptorSize) {
+    if (desc->Type != EFI_CONVENTIONAL_MEMORY)
+      continue;
+    s = MAX(desc->PhysicalStart, from);
+    e = MIN(desc->PhysicalStart + desc->NumberOfPages * EFI_PAGE_SIZE, boot_alloc_limit);
+    if (s < e && (!found || s < *start)) {
+      *start = s;
+      *end   = e;
+      found  = true;
+    }
+  }
+  return found;
+}
+
+// Take 'n' contiguous pages from EFI conventional memory, moving on to
+// the next range of it that is big enough when the current one is used
+// up.  Page 0 is never used.  Returns the physical address or 0.
+static physaddr_t
+boot_alloc_efi(size_t n) {
+  struct boot_range *r = boot_nranges ? &boot_ranges[boot_nranges - 1] : NULL;
+  physaddr_t start = 0, end = r ? boot_limit : PGSIZE;
+
+  if (!r || boot_limit - r->end < n * PGSIZE) {
+    do {
+      if (!boot_next_range(end, &start, &end))
+        return 0;
+    } while (end - start < n * PGSIZE);
+    if (boot_nranges == BOOT_ALLOC_MAXRANGES)
+      return 0;
+    r        = &boot_ranges[boot_nranges++];
+    r->start = r->end = start;
+    boot_limit        = end;
+  }
+
+  r->end += n * PGSIZE;
+  return r->end - n * PGSIZE;
+}
+
+// Page tables are reached through the identity map of the first GB
+// until page_init() has mapped all of memory at KERNBASE.
+static void *
+pt_kaddr(physaddr_t pa) {
+  return pmap_direct ? (void *)(pa + KERNBASE) : (void *)pa;
+}
+
+static physaddr_t
+pt_paddr(void *va) {
+  return pmap_direct ? PADDR(va) : (physaddr_t)va;
+}
+
+// Take a zeroed page for a page table.  The first ones come from the
+// pool bootstrap.S reserves after its own tables, which is enough to
+// map the loader parameters and the memory map; the rest come from
+// EFI conventional memory, so early mappings are not limited by the
+// size of the pool.  Once page_init() has taken over, from page_alloc().
+pde_t *
+alloc_pde_early_boot(void) {
+  extern uintptr_t pdebootstart, pdefreestart, pdefreeend;
+  static uintptr_t pdefree;
+  struct PageInfo *pp;
+  physaddr_t pa;
+  pde_t *ret;
+
+  if (!pdefree)
+    pdefree = pmap_1g_pages ? (uintptr_t)&pdebootstart : (uintptr_t)&pdefreestart;
+  if (pdefree < (uintptr_t)&pdefreeend) {
+    ret = pt_kaddr(pdefree);
+    pdefree += PGSIZE;
+    return ret;
+  }
+
+  if (boot_closed) {
+    if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+      panic("out of memory for page tables");
+    return page2kva(pp);
+  }
+
+  if ((pa = boot_alloc_efi(1)) == 0)
+    panic("out of early boot page table pages");
+  ret = pt_kaddr(pa);
+  memset(ret, 0, PGSIZE);
+  return ret;
+}
+
+// Stop early allocation and report the memory map ranges it used, for
+// the physical page allocator to keep out of its free lists.
+size_t
+boot_alloc_handoff(const struct boot_range **ranges) {
+  boot_closed = true;
+  *ranges     = boot_ranges;
+  return boot_nranges;
+}
+
+// Return the table an upper-level entry points to, allocating it if
+// the entry is empty.  A 1GB page in the entry is split into 2MB pages
+// with the same attributes.
+static pde_t *
+next_table_early_boot(uint64_t *entry) {
+  pde_t *table;
+  uint64_t phys, flags;
+  int i;
+
+  if (*entry & PTE_P && !(*entry & PTE_PS))
+    return pt_kaddr(PTE_ADDR(*entry));
+
+  table = alloc_pde_early_boot();
+  if (*entry & PTE_P) {
+    phys  = LARGE_ADDR(*entry, PDPSIZE);
+    flags = *entry & ~LARGE_ADDR(*entry, PDPSIZE);
+    for (i = 0; i < NPDENTRIES; i++)
+      table[i] = (phys + (uint64_t)i * PTSIZE) | flags;
+  }
+  *entry = pt_paddr(table) | PTE_P | PTE_W;
+  return table;
+}
+
+// Map [addr, addr + sz) to addr_phys with large pages carrying the
+// 'attr' bits besides PTE_P and PTE_PS.  Uses 1GB pages where the CPU
+// supports them and both addresses are 1GB-aligned, and 2MB pages
+// elsewhere.  A GB that already has a page directory keeps it and gets
+// its entries rewritten with 2MB pages, so the table is neither leaked
+// nor dropped from under other mappings.
+static void
+map_large_early_boot(uintptr_t addr, uintptr_t addr_phys, size_t sz, uint64_t attr) {
+  extern uintptr_t pml4phys;
+  pml4e_t *pml4 = pt_kaddr((physaddr_t)&pml4phys);
+  pdpe_t *pdpt, *pdpe;
+  pde_t *pde;
+
+  uintptr_t addr_curr, addr_curr_phys, addr_end;
+  addr_curr      = ROUNDDOWN(addr, PTSIZE);
+  addr_curr_phys = ROUNDDOWN(addr_phys, PTSIZE);
+  addr_end       = ROUNDUP(addr + sz, PTSIZE);
+
+  while (addr_curr < addr_end) {
+    pdpt = next_table_early_boot(&pml4[PML4(addr_curr)]);
+    pdpe = &pdpt[PDPE(addr_curr)];
+
+    if (pmap_1g_pages && !(addr_curr & (PDPSIZE - 1)) &&
+        !(addr_curr_phys & (PDPSIZE - 1)) && addr_end - addr_curr >= PDPSIZE &&
+        (!(*pdpe & PTE_P) || (*pdpe & PTE_PS))) {
+      *pdpe = addr_curr_phys | PTE_P | PTE_PS | global_bit(addr_curr) | attr;
+      addr_curr += PDPSIZE;
+      addr_curr_phys += PDPSIZE;
+      continue;
+    }
+
+    // Leave a 1GB page alone if it already maps this part the same way.
+    if ((*pdpe & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS) &&
+        LARGE_ADDR(*pdpe, PDPSIZE) + (addr_curr & (PDPSIZE - 1)) == addr_curr_phys &&
+        (*pdpe & LARGE_ATTR_BITS) == (attr & LARGE_ATTR_BITS)) {
+      addr_curr += PTSIZE;
+      addr_curr_phys += PTSIZE;
+      continue;
+    }
+
+    pde = next_table_early_boot(pdpe);
+    pde[PDX(addr_curr)] = addr_curr_phys | PTE_P | PTE_PS | global_bit(addr_curr) | attr;
+    addr_curr += PTSIZE;
+    addr_curr_phys += PTSIZE;
+  }
+}
+
+// Map [addr, addr + sz) to addr_phys read-write.  'attr' is or'ed into
+// every entry, e.g. PTE_WC to select the memory type.
+void
+map_addr_early_boot(uintptr_t addr, uintptr_t addr_phys, size_t sz, uint64_t attr) {
+  map_large_early_boot(addr, addr_phys, sz, PTE_W | attr);
+}
+
+// Write-protect kernel text and rodata and make everything else in the
+// KERNBASE map and in the identity map of the first GB non-executable.
+// The identity alias of text and rodata becomes read-only as well.
+// This needs the KERN_LARGEPAGE layout, where each segment starts a 2MB
+// page; other builds leave the kernel mapped read-write-execute.
+void
+pmap_protect_kernel(void) {
+#ifdef KERN_LARGEPAGE
+  extern char __text_start[], __rodata_start[], __data_start[], end[];
+  uintptr_t text = (uintptr_t)__text_start, rodata = (uintptr_t)__rodata_start;
+  uintptr_t data = (uintptr_t)__data_start, image_end = ROUNDUP((uintptr_t)end, PTSIZE);
+  uint64_t nx = 0;
+  uint32_t edx;
+
+  assert(((text | rodata | data) & (PTSIZE - 1)) == 0);
+
+  cpuid(0x80000001, NULL, NULL, NULL, &edx);
+  if (edx & CPUID_EXT_EDX_NX) {
+    wrmsr(EFER_MSR, rdmsr(EFER_MSR) | EFER_NXE);
+    nx = PTE_NX;
+  }
+
+  // The kernel image first: splitting a 1GB page copies its attributes,
+  // and the text this runs from must never be mapped non-executable.
+  // Only then the rest of the KERNBASE GB around the image.
+  map_large_early_boot(text, PADDR(__text_start), rodata - text, 0);
+  map_large_early_boot(rodata, PADDR(__rodata_start), data - rodata, nx);
+  map_large_early_boot(data, PADDR(__data_start), image_end - data, PTE_W | nx);
+  map_large_early_boot(KERNBASE, 0, text - KERNBASE, PTE_W | nx);
+  map_large_early_boot(image_end, image_end - KERNBASE, KERNBASE + PDPSIZE - image_end, PTE_W | nx);
+
+  // Nothing runs from the identity map any more, but page tables are
+  // still written through it.
+  map_large_early_boot(0, 0, PDPSIZE, PTE_W | nx);
+  map_large_early_boot(PADDR(__text_start), PADDR(__text_start), data - text, nx);
+
+  lcr0(rcr0() | CR0_WP);
+  tlbflush_all();
+#endif
+}
+
+static bool
+page_free_test(int order, size_t pfn) {
+  size_t bit = pfn >> order;
+  return page_free_map[order][bit / 64] & (1ULL << (bit % 64));
+}
+
+static void
+page_free_push(struct PageInfo *pp, int order) {
+  size_t bit = (pp - pages) >> order;
+
+  pp->pp_prev = NULL;
+  pp->pp_link = page_free_list[order];
+  if (pp->pp_link)
+    pp->pp_link->pp_prev = pp;
+  page_free_list[order] = pp;
+  page_free_map[order][bit / 64] |= 1ULL << (bit % 64);
+  page_free_blocks[order]++;
+  page_free_orders |= 1U << order;
+}
+
+static void
+page_free_remove(struct PageInfo *pp, int order) {
+  size_t bit = (pp - pages) >> order;
+
+  if (pp->pp_prev)
+    pp->pp_prev->pp_link = pp->pp_link;
+  else
+    page_free_list[order] = pp->pp_link;
+  if (pp->pp_link)
+    pp->pp_link->pp_prev = pp->pp_prev;
+  pp->pp_link = pp->pp_prev = NULL;
+  page_free_map[order][bit / 64] &= ~(1ULL << (bit % 64));
+  if (!--page_free_blocks[order])
+    page_free_orders &= ~(1U << order);
+}
+
+// Allocate 2^order physically contiguous pages.  Takes the first block
+// of the smallest order that is not empty and returns the halves it
+// does not need to the lower orders.  Fills the pages with zeroes if
+// (alloc_flags & ALLOC_ZERO).  Returns NULL if out of memory.
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags) {
+  struct PageInfo *pp;
+  uint32_t avail;
+  int k;
+
+  assert(order >= 0 && order <= PAGE_MAX_ORDER);
+  if ((avail = page_free_orders >> order) == 0)
+    return NULL;
+
+  k  = order + __builtin_ctz(avail);
+  pp = page_free_list[k];
+  page_free_remove(pp, k);
+  while (k > order) {
+    k--;
+    page_free_push(pp + (1UL << k), k);
+  }
+
+  if (alloc_flags & ALLOC_ZERO)
+    memset(page2kva(pp), 0, PGSIZE << order);
+  return pp;
+}
+
+struct PageInfo *
+page_alloc(int alloc_flags) {
+  return page_alloc_order(0, alloc_flags);
+}
+
+// Return a block from page_alloc_order() to the free lists, merging
+// it with its buddy for as long as the buddy is free too.
+void
+page_free_order(struct PageInfo *pp, int order) {
+  size_t pfn = pp - pages, buddy;
+
+  assert(order >= 0 && order <= PAGE_MAX_ORDER);
+  if (pp->pp_ref || (pfn & ((1UL << order) - 1)))
+    panic("page_free_order: bad page %lx order %d", (unsigned long)page2pa(pp), order);
+
+  for (; order < PAGE_MAX_ORDER; order++) {
+    buddy = pfn ^ (1UL << order);
+    if (buddy + (1UL << order) > npages || !page_free_test(order, buddy))
+      break;
+    page_free_remove(&pages[buddy], order);
+    pfn &= ~(1UL << order);
+  }
+  page_free_push(&pages[pfn], order);
+}
+
+void
+page_free(struct PageInfo *pp) {
+  page_free_order(pp, 0);
+}
+
+// Decrement the reference count on a page, freeing it if there are
+// no more refs.
+void
+page_decref(struct PageInfo *pp) {
+  if (--pp->pp_ref == 0)
+    page_free(pp);
+}
+
+// Free the pages in [start, end) as the largest aligned blocks they hold.
+static void
+page_free_range(physaddr_t start, physaddr_t end) {
+  size_t pfn = PGNUM(ROUNDUP(start, PGSIZE)), last = PGNUM(end);
+  int order;
+
+  while (pfn < last) {
+    order = 0;
+    while (order < PAGE_MAX_ORDER && !(pfn & (1UL << order)) &&
+           pfn + (2UL << order) <= last)
+      order++;
+    page_free_order(&pages[pfn], order);
+    pfn += 1UL << order;
+  }
+}
+
+#define CHECK_BLOCKS 64
+#define CHECK_ROUNDS 1024
+
+// Allocate and free blocks of random orders, checking that blocks are
+// aligned, zeroed on request, outside page 0 and the early allocator's
+// ranges, and never handed out twice.  Every page of a live block has
+// a stamp naming the block, which a second owner would overwrite.
+// Freeing everything must restore the free counts of each order.
+static void
+check_page_alloc(void) {
+  static struct PageInfo *blk[CHECK_BLOCKS];
+  static int blk_order[CHECK_BLOCKS];
+  size_t start[PAGE_NORDERS], pfn, i, j, k;
+  uint32_t seed = 1;
+  uint64_t *stamp;
+  int order;
+
+  memcpy(start, page_free_blocks, sizeof(start));
+  memset(blk, 0, sizeof(blk));
+
+  for (i = 0; i < CHECK_ROUNDS; i++) {
+    seed = seed * 1103515245 + 12345;
+    k    = (seed >> 8) % CHECK_BLOCKS;
+
+    if (blk[k]) {
+      pfn = blk[k] - pages;
+      for (j = 0; j < (1UL << blk_order[k]); j++) {
+        stamp = page2kva(&pages[pfn + j]);
+        assert(stamp[0] == k && stamp[1] == pfn + j);
+      }
+      page_free_order(blk[k], blk_order[k]);
+      blk[k] = NULL;
+      continue;
+    }
+
+    order = (seed >> 20) % PAGE_NORDERS;
+    if (seed & 0x10000)
+      order %= 3;
+    if ((blk[k] = page_alloc_order(order, seed & 0x20000 ? ALLOC_ZERO : 0)) == NULL)
+      continue;
+    blk_order[k] = order;
+
+    pfn = blk[k] - pages;
+    assert(pfn > 0 && !(pfn & ((1UL << order) - 1)) && pfn + (1UL << order) <= npages);
+    for (j = 0; j < boot_nranges; j++)
+      assert(page2pa(blk[k]) + (PGSIZE << order) <= boot_ranges[j].start ||
+             page2pa(blk[k]) >= boot_ranges[j].end);
+    if (seed & 0x20000)
+      for (j = 0; j < (PGSIZE << order) / sizeof(uint64_t); j += 509)
+        assert(((uint64_t *)page2kva(blk[k]))[j] == 0);
+    for (j = 0; j < (1UL << order); j++) {
+      stamp    = page2kva(&pages[pfn + j]);
+      stamp[0] = k;
+      stamp[1] = pfn + j;
+    }
+  }
+
+  for (k = 0; k < CHECK_BLOCKS; k++)
+    if (blk[k])
+      page_free_order(blk[k], blk_order[k]);
+  for (order = 0; order < PAGE_NORDERS; order++)
+    assert(page_free_blocks[order] == start[order]);
+
+  cprintf("check_page_alloc() succeeded!\n");
+}
+
+// Zeroed kernel memory for page_init() from the early allocator.
+static void *
+boot_alloc(size_t n) {
+  physaddr_t pa;
+  void *va;
+
+  if ((pa = boot_alloc_efi(ROUNDUP(n, PGSIZE) / PGSIZE)) == 0)
+    panic("out of memory for the page allocator");
+  va = pt_kaddr(pa);
+  memset(va, 0, ROUNDUP(n, PGSIZE));
+  return va;
+}
+
+// Set up the buddy allocator from the EFI memory map.  Maps all of
+// memory at KERNBASE, allocates the page array and the free bitmaps
+// with the early allocator, then takes over from it and frees every
+// conventional memory page it has not used.
+void
+page_init(void) {
+  EFI_MEMORY_DESCRIPTOR *desc_start = (EFI_MEMORY_DESCRIPTOR *)uefi_lp->MemoryMap;
+  EFI_MEMORY_DESCRIPTOR *desc_end = (EFI_MEMORY_DESCRIPTOR *)(uefi_lp->MemoryMap + uefi_lp->MemoryMapSize);
+  EFI_MEMORY_DESCRIPTOR *desc;
+  const struct boot_range *used;
+  size_t nused, i;
+  physaddr_t s, e, top = 0;
+  int order;
+
+  for (desc = desc_start; desc < desc_end; desc = (void *)desc + uefi_lp->MemoryMapDescriptorSize)
+    if (desc->Type == EFI_CONVENTIONAL_MEMORY)
+      top = MAX(top, desc->PhysicalStart + desc->NumberOfPages * EFI_PAGE_SIZE);
+  top = MIN(ROUNDDOWN(top, PGSIZE), (physaddr_t)DIRECTMAP_LIMIT);
+
+  // bootstrap.S maps the first GB at KERNBASE.
+  if (top > PDPSIZE)
+    map_large_early_boot(KERNBASE + PDPSIZE, PDPSIZE, top - PDPSIZE,
+                         PTE_W | (rdmsr(EFER_MSR) & EFER_NXE ? PTE_NX : 0));
+  tlbflush_all();
+  pmap_direct      = true;
+  boot_alloc_limit = top;
+
+  npages = PGNUM(top);
+  pages  = boot_alloc(npages * sizeof(struct PageInfo));
+  for (order = 0; order < PAGE_NORDERS; order++)
+    page_free_map[order] = boot_alloc(ROUNDUP((npages >> order) + 1, 64) / 8);
+
+  nused = boot_alloc_handoff(&used);
+  for (desc = desc_start; desc < desc_end; desc = (void *)desc + uefi_lp->MemoryMapDescriptorSize) {
+    if (desc->Type != EFI_CONVENTIONAL_MEMORY)
+      continue;
+    s = MAX(desc->PhysicalStart, (physaddr_t)PGSIZE);
+    e = MIN(desc->PhysicalStart + desc->NumberOfPages * EFI_PAGE_SIZE, top);
+
+    // The used ranges are sorted and each lies within one descriptor.
+    for (i = 0; i < nused && s < e; i++) {
+      if (used[i].end <= s || used[i].start >= e)
+        continue;
+      if (used[i].start > s)
+        page_free_range(s, used[i].start);
+      s = used[i].end;
+    }
+    if (s < e)
+      page_free_range(s, e);
+  }
+
+  check_page_alloc();
+}
+
+// Print the number of free blocks of each order.
+void
+page_stats(void) {
+  size_t total = 0;
+  int order;
+
+  for (order = 0; order < PAGE_NORDERS; order++) {
+    cprintf("  order %2d (%6lu KB): %lu free\n", order,
+            (unsigned long)(PGSIZE << order) / 1024, (unsigned long)page_free_blocks[order]);
+    total += page_free_blocks[order] << order;
+  }
+  cprintf("%lu of %lu pages free\n", (unsigned long)total, (unsigned long)npages);
+}
+
+void
+pmap_space_init(struct pmap_space *space, pml4e_t *pml4) {
+  space->pml4     = PADDR(pml4);
+  space->pcid     = 0;
+  space->pcid_gen = 0;
+}
+
+// Load the space's page tables.  With PCIDs, a space keeps its tag
+// and its TLB entries until all tags have been handed out; then the
+// whole TLB is flushed and tags are assigned again on next use.
+void
+pmap_switch(struct pmap_space *space) {
+  uint64_t cr3 = space->pml4;
+
+  if (pmap_pcid) {
+    if (space->pcid_gen == pcid_gen)
+      cr3 |= space->pcid | CR3_PCID_NOFLUSH;
+    else {
+      if (pcid_next > CR3_PCID_MASK) {
+        tlbflush_all();
+        pcid_gen++;
+        pcid_next = 1;
+      }
+      space->pcid     = pcid_next++;
+      space->pcid_gen = pcid_gen;
+      cr3 |= space->pcid;
+    }
+  }
+  lcr3(cr3);
+}
+
+// Switch between two address spaces CR3_BENCH_ROUNDS times, touching
+// CR3_BENCH_PAGES kernel (global) and as many identity mapped
+// (non-global) 2MB pages after each switch.  Returns TSC cycles per
+// round.  Without PCIDs, 'a' and 'b' are loaded with PCID 0.
+static uint64_t
+cr3_bench_run(struct pmap_space *a, struct pmap_space *b, bool tagged) {
+  uint64_t start;
+  int i, j;
+
+  start = read_tsc();
+  for (i = 0; i < CR3_BENCH_ROUNDS; i++) {
+    struct pmap_space *s = i & 1 ? b : a;
+    if (tagged)
+      pmap_switch(s);
+    else
+      lcr3(s->pml4);
+    for (j = 1; j <= CR3_BENCH_PAGES; j++) {
+      (void)*(volatile char *)(KERNBASE + (uintptr_t)j * PTSIZE);
+      (void)*(volatile char *)((uintptr_t)j * PTSIZE);
+    }
+  }
+  return (read_tsc() - start) / CR3_BENCH_ROUNDS;
+}
+
+// Compare CR3 switch cost with no global pages, with global kernel
+// pages, and with global pages plus PCIDs.
+void
+pmap_cr3_bench(void) {
+  static pml4e_t bench_pml4[NPDENTRIES] __attribute__((aligned(PGSIZE)));
+  struct pmap_space boot, other;
+  uint64_t cr3 = rcr3(), cr4 = rcr4();
+
+  memcpy(bench_pml4, (void *)PTE_ADDR(cr3), PGSIZE);
+  boot.pml4 = PTE_ADDR(cr3);
+  boot.pcid = boot.pcid_gen = 0;
+  pmap_space_init(&other, bench_pml4);
+
+  cprintf("CR3 switch + %d page touches, cycles per round:\n", 2 * CR3_BENCH_PAGES);
+  lcr4(cr4 & ~CR4_PGE);
+  cprintf("  no global pages  %6lu\n", (unsigned long)cr3_bench_run(&boot, &other, false));
+  lcr4(cr4);
+  cprintf("  global kernel    %6lu\n", (unsigned long)cr3_bench_run(&boot, &other, false));
+  if (pmap_pcid)
+    cprintf("  global + PCID    %6lu\n", (unsigned long)cr3_bench_run(&boot, &other, true));
+  else
+    cprintf("  global + PCID    not supported\n");
+
+  // Back to the boot tables with PCID 0, dropping the bench's tags.
+  lcr3(PTE_ADDR(cr3));
+  tlbflush_all();
+}
@@ -0,0 +1,100 @@
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+// Physical address of a kernel virtual address in the KERNBASE map.
+#define PADDR(kva) _paddr(__FILE__, __LINE__, kva)
+
+static inline physaddr_t
+_paddr(const char *file, int line, void *kva) {
+  if ((uintptr_t)kva < KERNBASE)
+    _panic(file, line, "PADDR called with invalid kva %p", kva);
+  return (physaddr_t)kva - KERNBASE;
+}
+
+extern struct PageInfo *pages;
+extern size_t npages;
+
+// Kernel virtual address of a physical address in the KERNBASE map.
+#define KADDR(pa) _kaddr(__FILE__, __LINE__, pa)
+
+static inline void *
+_kaddr(const char *file, int line, physaddr_t pa) {
+  if (PGNUM(pa) >= npages)
+    _panic(file, line, "KADDR called with invalid pa %lx", (unsigned long)pa);
+  return (void *)(pa + KERNBASE);
+}
+
+// Largest block order of the page allocator: 2^10 pages, 4MB.
+#define PAGE_MAX_ORDER 10
+#define PAGE_NORDERS   (PAGE_MAX_ORDER + 1)
+
+enum {
+  // For page_alloc, zero the returned physical page.
+  ALLOC_ZERO = 1 << 0,
+};
+
+static inline physaddr_t
+page2pa(struct PageInfo *pp) {
+  return (pp - pages) << PGSHIFT;
+}
+
+static inline struct PageInfo *
+pa2page(physaddr_t pa) {
+  if (PGNUM(pa) >= npages)
+    panic("pa2page called with invalid pa");
+  return &pages[PGNUM(pa)];
+}
+
+static inline void *
+page2kva(struct PageInfo *pp) {
+  return KADDR(page2pa(pp));
+}
+
+// An address space that pmap_switch() can load.  With PCIDs enabled
+// its TLB entries are tagged and survive switches to other spaces.
+struct pmap_space {
+  physaddr_t pml4;   // physical address of the top-level table
+  uint16_t pcid;     // tag, valid while pcid_gen is current
+  uint64_t pcid_gen;
+};
+
+// Physical pages [start, end) taken by the early page-table allocator.
+struct boot_range {
+  physaddr_t start;
+  physaddr_t end;
+};
+
+#define BOOT_ALLOC_MAXRANGES 16
+
+// True if the CPU supports 1GB pages; set by pmap_init_early().
+extern bool pmap_1g_pages;
+// True if address spaces are PCID-tagged; set by pmap_init_early().
+extern bool pmap_pcid;
+
+void pmap_init_early(void);
+void tlbflush_all(void);
+pde_t *alloc_pde_early_boot(void);
+size_t boot_alloc_handoff(const struct boot_range **ranges);
+void map_addr_early_boot(uintptr_t addr, uintptr_t addr_phys, size_t sz, uint64_t attr);
+void pmap_protect_kernel(void);
+
+void page_init(void);
+struct PageInfo *page_alloc(int alloc_flags);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void page_free(struct PageInfo *pp);
+void page_free_order(struct PageInfo *pp, int order);
+void page_decref(struct PageInfo *pp);
+void page_stats(void);
+
+void pmap_space_init(struct pmap_space *space, pml4e_t *pml4);
+void pmap_switch(struct pmap_space *space);
+void pmap_cr3_bench(void);
+
+#endif // !JOS_KERN_PMAP_H
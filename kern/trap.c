@@ -0,0 +1,182 @@
+#include <inc/mmu.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/trap.h>
+#include <kern/console.h>
+#include <kern/picirq.h>
+#include <kern/binlog.h>
+
+/* Interrupt descriptor table. */
+static struct Gatedesc idt[256] = {{0}};
+static struct Pseudodesc idt_pd = {sizeof(idt) - 1, (uint64_t)idt};
+
+static const char *
+trapname(int trapno) {
+  static const char *const excnames[] = {
+      "Divide error",
+      "Debug",
+      "Non-Maskable Interrupt",
+      "Breakpoint",
+      "Overflow",
+      "BOUND Range Exceeded",
+      "Invalid Opcode",
+      "Device Not Available",
+      "Double Fault",
+      "Coprocessor Segment Overrun",
+      "Invalid TSS",
+      "Segment Not Present",
+      "Stack Fault",
+      "General Protection",
+      "Page Fault",
+      "(unknown trap)",
+      "x87 FPU Floating-Point Error",
+      "Alignment Check",
+      "Machine-Check",
+      "SIMD Floating-Point Exception"};
+
+  if (trapno < sizeof(excnames) / sizeof(excnames[0]))
+    return excnames[trapno];
+  if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + MAX_IRQS)
+    return "Hardware Interrupt";
+  return "(unknown trap)";
+}
+
+static uint16_t
+read_cs(void) {
+  uint16_t cs;
+  __asm __volatile("movw %%cs,%0"
+                   : "=r"(cs));
+  return cs;
+}
+
+void
+trap_init(void) {
+  extern void divide_thdlr(void);
+  extern void debug_thdlr(void);
+  extern void nmi_thdlr(void);
+  extern void brkpt_thdlr(void);
+  extern void oflow_thdlr(void);
+  extern void bound_thdlr(void);
+  extern void illop_thdlr(void);
+  extern void device_thdlr(void);
+  extern void dblflt_thdlr(void);
+  extern void tss_thdlr(void);
+  extern void segnp_thdlr(void);
+  extern void stack_thdlr(void);
+  extern void gpflt_thdlr(void);
+  extern void pgflt_thdlr(void);
+  extern void fperr_thdlr(void);
+  extern void align_thdlr(void);
+  extern void mchk_thdlr(void);
+  extern void simderr_thdlr(void);
+  extern void irq0_thdlr(void), irq1_thdlr(void), irq2_thdlr(void), irq3_thdlr(void);
+  extern void irq4_thdlr(void), irq5_thdlr(void), irq6_thdlr(void), irq7_thdlr(void);
+  extern void irq8_thdlr(void), irq9_thdlr(void), irq10_thdlr(void), irq11_thdlr(void);
+  extern void irq12_thdlr(void), irq13_thdlr(void), irq14_thdlr(void), irq15_thdlr(void);
+  extern void default_thdlr(void);
+
+  static void (*const irq_thdlrs[MAX_IRQS])(void) = {
+      irq0_thdlr, irq1_thdlr, irq2_thdlr, irq3_thdlr,
+      irq4_thdlr, irq5_thdlr, irq6_thdlr, irq7_thdlr,
+      irq8_thdlr, irq9_thdlr, irq10_thdlr, irq11_thdlr,
+      irq12_thdlr, irq13_thdlr, irq14_thdlr, irq15_thdlr};
+
+  // We run on the code segment the loader left us in.
+  uint16_t cs = read_cs();
+  int i;
+
+  for (i = 0; i < sizeof(idt) / sizeof(idt[0]); i++)
+    SETGATE(idt[i], 0, cs, default_thdlr, 0);
+
+  SETGATE(idt[T_DIVIDE], 0, cs, divide_thdlr, 0);
+  SETGATE(idt[T_DEBUG], 0, cs, debug_thdlr, 0);
+  SETGATE(idt[T_NMI], 0, cs, nmi_thdlr, 0);
+  SETGATE(idt[T_BRKPT], 0, cs, brkpt_thdlr, 0);
+  SETGATE(idt[T_OFLOW], 0, cs, oflow_thdlr, 0);
+  SETGATE(idt[T_BOUND], 0, cs, bound_thdlr, 0);
+  SETGATE(idt[T_ILLOP], 0, cs, illop_thdlr, 0);
+  SETGATE(idt[T_DEVICE], 0, cs, device_thdlr, 0);
+  SETGATE(idt[T_DBLFLT], 0, cs, dblflt_thdlr, 0);
+  SETGATE(idt[T_TSS], 0, cs, tss_thdlr, 0);
+  SETGATE(idt[T_SEGNP], 0, cs, segnp_thdlr, 0);
+  SETGATE(idt[T_STACK], 0, cs, stack_thdlr, 0);
+  SETGATE(idt[T_GPFLT], 0, cs, gpflt_thdlr, 0);
+  SETGATE(idt[T_PGFLT], 0, cs, pgflt_thdlr, 0);
+  SETGATE(idt[T_FPERR], 0, cs, fperr_thdlr, 0);
+  SETGATE(idt[T_ALIGN], 0, cs, align_thdlr, 0);
+  SETGATE(idt[T_MCHK], 0, cs, mchk_thdlr, 0);
+  SETGATE(idt[T_SIMDERR], 0, cs, simderr_thdlr, 0);
+
+  for (i = 0; i < MAX_IRQS; i++)
+    SETGATE(idt[IRQ_OFFSET + i], 0, cs, irq_thdlrs[i], 0);
+
+  lidt(&idt_pd);
+}
+
+void
+print_trapframe(struct Trapframe *tf) {
+  cprintf("TRAP frame at %p\n", tf);
+  cprintf("  r15  0x%08lx  r14  0x%08lx  r13  0x%08lx\n",
+          (unsigned long)tf->tf_regs.reg_r15, (unsigned long)tf->tf_regs.reg_r14,
+          (unsigned long)tf->tf_regs.reg_r13);
+  cprintf("  r12  0x%08lx  r11  0x%08lx  r10  0x%08lx\n",
+          (unsigned long)tf->tf_regs.reg_r12, (unsigned long)tf->tf_regs.reg_r11,
+          (unsigned long)tf->tf_regs.reg_r10);
+  cprintf("  r9   0x%08lx  r8   0x%08lx  rsi  0x%08lx\n",
+          (unsigned long)tf->tf_regs.reg_r9, (unsigned long)tf->tf_regs.reg_r8,
+          (unsigned long)tf->tf_regs.reg_rsi);
+  cprintf("  rdi  0x%08lx  rbp  0x%08lx  rdx  0x%08lx\n",
+          (unsigned long)tf->tf_regs.reg_rdi, (unsigned long)tf->tf_regs.reg_rbp,
+          (unsigned long)tf->tf_regs.reg_rdx);
+  cprintf("  rcx  0x%08lx  rbx  0x%08lx  rax  0x%08lx\n",
+          (unsigned long)tf->tf_regs.reg_rcx, (unsigned long)tf->tf_regs.reg_rbx,
+          (unsigned long)tf->tf_regs.reg_rax);
+  cprintf("  trap 0x%08lx %s\n", (unsigned long)tf->tf_trapno, trapname(tf->tf_trapno));
+  if (tf->tf_trapno == T_PGFLT)
+    cprintf("  cr2  0x%08lx\n", (unsigned long)rcr2());
+  cprintf("  err  0x%08lx\n", (unsigned long)tf->tf_err);
+  cprintf("  rip  0x%08lx %pS\n", (unsigned long)tf->tf_rip, (void *)tf->tf_rip);
+  cprintf("  cs   0x----%04x\n", (unsigned)tf->tf_cs);
+  cprintf("  flag 0x%08lx\n", (unsigned long)tf->tf_rflags);
+  cprintf("  rsp  0x%08lx\n", (unsigned long)tf->tf_rsp);
+  cprintf("  ss   0x----%04x\n", (unsigned)tf->tf_ss);
+}
+
+void
+trap(struct Trapframe *tf) {
+  uint8_t irq;
+
+  // The interrupted code may have had DF set,
+  // and some versions of GCC rely on DF being clear.
+  __asm __volatile("cld" ::
+                       : "cc");
+
+  if (tf->tf_trapno < IRQ_OFFSET || tf->tf_trapno >= IRQ_OFFSET + MAX_IRQS) {
+    print_trapframe(tf);
+    panic("unhandled trap in kernel");
+  }
+
+  irq = tf->tf_trapno - IRQ_OFFSET;
+  binlog("irq %u rip %lx\n", irq, (unsigned long)tf->tf_rip);
+
+  // Spurious interrupts must not be acknowledged, except that the
+  // master did deliver a real cascade interrupt for a spurious IRQ 15.
+  if (pic_spurious(irq)) {
+    if (irq >= 8)
+      pic_send_eoi(IRQ_SLAVE);
+    return;
+  }
+
+  switch (irq) {
+    case IRQ_KBD:
+      kbd_intr();
+      break;
+    case IRQ_SERIAL:
+      serial_intr();
+      break;
+    default:
+      break;
+  }
+  pic_send_eoi(irq);
+}
@@ -0,0 +1,16 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRAP_H
+#define JOS_KERN_TRAP_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/mmu.h>
+
+void trap_init(void);
+void print_trapframe(struct Trapframe *tf);
+void trap(struct Trapframe *tf);
+
+#endif /* JOS_KERN_TRAP_H */
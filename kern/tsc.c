@@ -0,0 +1,56 @@
+// Time stamp counter calibration against the 8254 PIT.
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+#include <kern/tsc.h>
+
+#define PIT_FREQ     1193182 // PIT input clock, Hz
+#define PIT_CH2      0x42    // Channel 2 data port
+#define PIT_CMD      0x43    // Mode/command register
+#define PIT_GATE     0x61    // Channel 2 gate and speaker control
+#define PIT_GATE_ON  0x01    //   Gate input of channel 2
+#define PIT_SPKR     0x02    //   Speaker data enable
+#define PIT_OUT2     0x20    //   Output of channel 2
+#define PIT_CAL_MS   10      // Calibration interval, ms
+#define PIT_CAL_SPIN 10000000
+
+uint64_t tsc_freq;
+
+// Count TSC cycles while PIT channel 2 counts down PIT_CAL_MS
+// milliseconds in one-shot mode.
+void
+tsc_calibrate(void) {
+  uint16_t latch = PIT_FREQ / (1000 / PIT_CAL_MS);
+  uint64_t start, end;
+  int spin;
+
+  outb(PIT_GATE, (inb(PIT_GATE) & ~PIT_SPKR) | PIT_GATE_ON);
+  // Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count)
+  outb(PIT_CMD, 0xB0);
+  outb(PIT_CH2, latch & 0xFF);
+  outb(PIT_CH2, latch >> 8);
+
+  start = read_tsc();
+  for (spin = 0; !(inb(PIT_GATE) & PIT_OUT2) && spin < PIT_CAL_SPIN; spin++)
+    /* do nothing */;
+  end = read_tsc();
+
+  if (spin < PIT_CAL_SPIN)
+    tsc_freq = (end - start) * (1000 / PIT_CAL_MS);
+}
+
+uint64_t
+tsc_to_us(uint64_t cycles) {
+  if (tsc_freq < 1000000)
+    return 0;
+  return cycles / (tsc_freq / 1000000);
+}
+
+// Throughput in MB/s of moving 'bytes' bytes in 'cycles' TSC cycles.
+uint64_t
+tsc_rate_mbs(uint64_t bytes, uint64_t cycles) {
+  uint64_t us = tsc_to_us(cycles);
+
+  return us ? bytes / us : 0;
+}
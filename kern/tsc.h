@@ -0,0 +1,16 @@
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// TSC frequency in Hz, zero until tsc_calibrate() has run.
+extern uint64_t tsc_freq;
+
+void tsc_calibrate(void);
+uint64_t tsc_to_us(uint64_t cycles);
+uint64_t tsc_rate_mbs(uint64_t bytes, uint64_t cycles);
+
+#endif // !JOS_KERN_TSC_H
@@ -8,6 +8,10 @@
 #include <inc/stdarg.h>
 #include <inc/error.h>
 
+#ifdef JOS_KERNEL
+#include <kern/kdebug.h>
+#endif
+
 /*
  * Space or zero padding and a field width are supported for the numeric
  * formats only.
@@ -16,6 +20,9 @@
  * and prints a string describing the error.
  * The integer may be positive or negative,
  * so that -E_NO_MEM and E_NO_MEM are equivalent.
+ *
+ * In the kernel, %pS prints a code address as file:line: function+offset
+ * and %pB does the same for a return address.
  */
 
 static const char *const error_string[MAXERROR] =
@@ -29,24 +36,86 @@ static const char *const error_string[MAXERROR] =
         [E_FAULT]       = "segmentation fault",
 };
 
+// Two-digit decimal lookup table: the digits of i are at 2 * i.
+static const char decimal_pairs[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// The output helpers below take the sink as a function pointer and are
+// always inlined, so vsnprintf(), which passes a fixed sink, gets a
+// copy of them with direct calls to it.
+#define FMT_INLINE static inline __attribute__((always_inline))
+
+// Emit n copies of padc.
+FMT_INLINE void
+putpad(void (*write)(const char *, size_t, void *), void *ctx, int padc, int n) {
+  char pad[16];
+
+  if (n <= 0)
+    return;
+  memset(pad, padc, MIN(n, (int)sizeof(pad)));
+  for (; n > (int)sizeof(pad); n -= sizeof(pad))
+    write(pad, sizeof(pad), ctx);
+  write(pad, n, ctx);
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+ * Print a number (base <= 16) padded to width with padc,
+ * using specified write function and associated pointer ctx.
+ * The digits are produced right to left into a local buffer,
+ * two at a time for base 10 and by shifting for bases 8 and 16,
+ * and emitted together with the padding in one span.
  */
-static void
-printnum(void (*putch)(int, void *), void *putdat,
+FMT_INLINE void
+printnum(void (*write)(const char *, size_t, void *), void *ctx,
          unsigned long long num, unsigned base, int width, int padc) {
-  // first recursively print all preceding (more significant) digits
-  if (num >= base) {
-    printnum(putch, putdat, num / base, base, width - 1, padc);
-  } else {
-    // print any needed pad characters before first digit
-    while (--width > 0)
-      putch(padc, putdat);
+  char buf[72]; // 64 binary digits and some padding
+  char *end = buf + sizeof(buf), *p = end;
+
+  switch (base) {
+    case 10:
+      for (; num >= 100; num /= 100) {
+        const char *d = &decimal_pairs[(num % 100) * 2];
+        *--p          = d[1];
+        *--p          = d[0];
+      }
+      if (num >= 10) {
+        *--p = decimal_pairs[num * 2 + 1];
+        *--p = decimal_pairs[num * 2];
+      } else
+        *--p = '0' + num;
+      break;
+    case 16:
+      do
+        *--p = "0123456789abcdef"[num & 0xF];
+      while ((num >>= 4) != 0);
+      break;
+    case 8:
+      do
+        *--p = '0' + (num & 7);
+      while ((num >>= 3) != 0);
+      break;
+    default:
+      do
+        *--p = "0123456789abcdef"[num % base];
+      while ((num /= base) != 0);
+      break;
+  }
+
+  // pad characters go in front of the first digit; any that
+  // do not fit in the buffer are printed separately first
+  width -= end - p;
+  if (width > p - buf) {
+    putpad(write, ctx, padc, width - (p - buf));
+    width = p - buf;
   }
+  for (; width > 0; width--)
+    *--p = padc;
 
-  // then print this (the least significant) digit
-  putch("0123456789abcdef"[num % base], putdat);
+  write(p, end - p, ctx);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -73,170 +142,374 @@ getint(va_list *ap, int lflag) {
     return va_arg(*ap, int);
 }
 
+#ifdef JOS_KERNEL
+// Print a code address as function+offset (file:line), or as a plain
+// hex address if there is no debug info for it.  A return address is
+// looked up one byte back so that it is attributed to the call.
+FMT_INLINE void
+printsym(void (*write)(const char *, size_t, void *), void *ctx,
+         uintptr_t addr, bool retaddr) {
+  const struct Ripsym *sym = debuginfo_sym(retaddr ? addr - 1 : addr);
+
+  if (!sym || !sym->file || !sym->fn_name) {
+    write("0x", 2, ctx);
+    printnum(write, ctx, addr, 16, -1, ' ');
+    return;
+  }
+  write(sym->file, strlen(sym->file), ctx);
+  write(":", 1, ctx);
+  printnum(write, ctx, sym->line, 10, -1, ' ');
+  write(": ", 2, ctx);
+  write(sym->fn_name, strlen(sym->fn_name), ctx);
+  write("+0x", 3, ctx);
+  printnum(write, ctx, addr - sym->fn_addr, 16, -1, ' ');
+}
+#endif
+
+// Print a string argument: at most precision characters (all if
+// precision is negative), non-printing ones shown as '?' if altflag.
+FMT_INLINE void
+printstr(void (*write)(const char *, size_t, void *), void *ctx,
+         const char *p, int width, int precision, int padc, int altflag) {
+  size_t len = strnlen(p, precision < 0 ? (size_t)-1 : (size_t)precision);
+  size_t i, run;
+
+  if (padc != '-')
+    putpad(write, ctx, padc, width - (int)len);
+  if (!altflag)
+    write(p, len, ctx);
+  else
+    for (i = 0; i < len; i += run) {
+      for (run = 0; i + run < len && p[i + run] >= ' ' && p[i + run] <= '~'; run++)
+        /* do nothing */;
+      if (run > 0)
+        write(p + i, run, ctx);
+      else {
+        write("?", 1, ctx);
+        run = 1;
+      }
+    }
+  if (padc == '-')
+    putpad(write, ctx, ' ', width - (int)len);
+}
+
 // Main function to format and print a string.
-void printfmt(void (*putch)(int, void *), void *putdat, const char *fmt, ...);
+void printfmt_span(void (*write)(const char *, size_t, void *), void *ctx, const char *fmt, ...);
 
-void
-vprintfmt(void (*putch)(int, void *), void *putdat, const char *fmt, va_list ap) {
-  register const char *p;
-  register int ch, err;
+// Parse the %-escape sequence that follows a '%' at *fmtp into op
+// and advance *fmtp past it.  Field widths given as '*' are only
+// noted here; print_op() fetches them from the argument list.
+static void
+parse_op(const char **fmtp, struct fmtop *op) {
+  const char *fmt = *fmtp;
+  int ch, n;
+
+  op->lit       = NULL;
+  op->len       = 0;
+  op->padc      = ' ';
+  op->lflag     = 0;
+  op->flags     = 0;
+  op->width     = -1;
+  op->precision = -1;
+
+reswitch:
+  switch (ch = *(unsigned char *)fmt++) {
+
+    // flag to pad on the right
+    case '-':
+      op->padc = '-';
+      goto reswitch;
+
+    // flag to pad with 0's instead of spaces
+    case '0':
+      op->padc = '0';
+      goto reswitch;
+
+    // width field
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      for (n = 0;; ++fmt) {
+        n  = n * 10 + ch - '0';
+        ch = *fmt;
+        if (ch < '0' || ch > '9')
+          break;
+      }
+      if (op->width < 0 && !(op->flags & FMTOP_STAR_WIDTH))
+        op->width = n;
+      else
+        op->precision = n;
+      goto reswitch;
+
+    case '*':
+      if (op->width < 0 && !(op->flags & FMTOP_STAR_WIDTH))
+        op->flags |= FMTOP_STAR_WIDTH;
+      else
+        op->flags |= FMTOP_STAR_PRECISION;
+      goto reswitch;
+
+    case '.':
+      if (op->width < 0 && !(op->flags & FMTOP_STAR_WIDTH))
+        op->width = 0;
+      goto reswitch;
+
+    case '#':
+      op->flags |= FMTOP_ALT;
+      goto reswitch;
+
+    // long flag (doubled for long long)
+    case 'l':
+      op->lflag++;
+      goto reswitch;
+
+    case 'p':
+#ifdef JOS_KERNEL
+      // %pS: symbolized code address, %pB: symbolized return address
+      if (*fmt == 'S' || *fmt == 'B') {
+        op->conv = *fmt++;
+        break;
+      }
+#endif
+      op->conv = 'p';
+      break;
+
+    case 'c':
+    case 'i':
+    case 's':
+    case 'd':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case '%':
+      op->conv = ch;
+      break;
+
+    // unrecognized escape sequence - just print it literally
+    default:
+      op->conv = 0;
+      op->lit  = "%";
+      op->len  = 1;
+      fmt      = *fmtp;
+      break;
+  }
+  *fmtp = fmt;
+}
+
+// Carry out one parsed piece of a format string.
+FMT_INLINE void
+print_op(void (*write)(const char *, size_t, void *), void *ctx,
+         const struct fmtop *op, va_list *ap) {
+  int width = op->width, precision = op->precision;
   unsigned long long num;
-  int base, lflag, width, precision, altflag;
-  char padc;
+  const char *p;
+  unsigned base;
+  int err;
+  char c;
+
+  if (op->flags & FMTOP_STAR_WIDTH)
+    width = va_arg(*ap, int);
+  if (op->flags & FMTOP_STAR_PRECISION)
+    precision = va_arg(*ap, int);
+
+  switch (op->conv) {
+    // literal text
+    case 0:
+      write(op->lit, op->len, ctx);
+      return;
+
+    // character
+    case 'c':
+      c = va_arg(*ap, int);
+      write(&c, 1, ctx);
+      return;
+
+    // error message
+    case 'i':
+      err = va_arg(*ap, int);
+      if (err < 0)
+        err = -err;
+      if (err >= MAXERROR || (p = error_string[err]) == NULL)
+        printfmt_span(write, ctx, "error %d", err);
+      else
+        write(p, strlen(p), ctx);
+      return;
+
+    // string
+    case 's':
+      if ((p = va_arg(*ap, char *)) == NULL)
+        p = "(null)";
+      printstr(write, ctx, p, width, precision, op->padc, op->flags & FMTOP_ALT);
+      return;
+
+#ifdef JOS_KERNEL
+    // symbolized code or return address
+    case 'S':
+    case 'B':
+      printsym(write, ctx, (uintptr_t)va_arg(*ap, void *), op->conv == 'B');
+      return;
+#endif
+
+    // (signed) decimal
+    case 'd':
+      num = getint(ap, op->lflag);
+      if ((long long)num < 0) {
+        write("-", 1, ctx);
+        num = -(long long)num;
+      }
+      base = 10;
+      break;
+
+    // unsigned decimal
+    case 'u':
+      num  = getuint(ap, op->lflag);
+      base = 10;
+      break;
+
+    // (unsigned) octal
+    case 'o':
+      num  = getuint(ap, op->lflag);
+      base = 8;
+      break;
+
+    // pointer
+    case 'p':
+      write("0x", 2, ctx);
+      num  = (unsigned long long)(uintptr_t)va_arg(*ap, void *);
+      base = 16;
+      break;
+
+    // (unsigned) hexadecimal
+    case 'x':
+    case 'X':
+      num  = getuint(ap, op->lflag);
+      base = 16;
+      break;
+
+    // escaped '%' character
+    default:
+      write("%", 1, ctx);
+      return;
+  }
+  printnum(write, ctx, num, base, width, op->padc);
+}
+
+// print_op() for sinks that are called through the pointer.
+static void
+print_op_generic(void (*write)(const char *, size_t, void *), void *ctx,
+                 const struct fmtop *op, va_list *ap) {
+  print_op(write, ctx, op, ap);
+}
+
+// Format into a sink that takes runs of characters.  Literal text
+// between conversions and whole string arguments are passed to
+// write() in one call each.
+void
+vprintfmt_span(void (*write)(const char *, size_t, void *), void *ctx, const char *fmt, va_list ap) {
+  const char *p;
+  struct fmtop op;
   va_list aq;
   va_copy(aq, ap);
 
   while (1) {
-    while ((ch = *(unsigned char *)fmt++) != '%') {
-      if (ch == '\0')
-        return;
-      putch(ch, putdat);
+    for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+      /* do nothing */;
+    if (fmt > p)
+      write(p, fmt - p, ctx);
+    if (*fmt++ == '\0')
+      break;
+    parse_op(&fmt, &op);
+    print_op_generic(write, ctx, &op, &aq);
+  }
+  va_end(aq);
+}
+
+// Split d->fmt into literal runs and conversions once.  Formats with
+// more than PRINTFMT_MAXOPS pieces are left to vprintfmt_span().
+static void
+parse_desc(struct printfmt_desc *d) {
+  const char *fmt = d->fmt, *p;
+  int n           = 0;
+
+  while (1) {
+    for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+      /* do nothing */;
+    if (fmt > p) {
+      if (n == PRINTFMT_MAXOPS)
+        goto toolong;
+      d->ops[n].conv = 0;
+      d->ops[n].lit  = p;
+      d->ops[n].len  = fmt - p;
+      d->ops[n].flags = 0;
+      n++;
     }
+    if (*fmt++ == '\0')
+      break;
+    if (n == PRINTFMT_MAXOPS)
+      goto toolong;
+    parse_op(&fmt, &d->ops[n++]);
+  }
+  d->nops = n;
+  __atomic_store_n(&d->state, PRINTFMT_PARSED, __ATOMIC_RELEASE);
+  return;
 
-    // Process a %-escape sequence
-    padc      = ' ';
-    width     = -1;
-    precision = -1;
-    lflag     = 0;
-    altflag   = 0;
-  reswitch:
-    switch (ch = *(unsigned char *)fmt++) {
-
-      // flag to pad on the right
-      case '-':
-        padc = '-';
-        goto reswitch;
-
-      // flag to pad with 0's instead of spaces
-      case '0':
-        padc = '0';
-        goto reswitch;
-
-      // width field
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-        for (precision = 0;; ++fmt) {
-          precision = precision * 10 + ch - '0';
-          ch        = *fmt;
-          if (ch < '0' || ch > '9')
-            break;
-        }
-        goto process_precision;
-
-      case '*':
-        precision = va_arg(aq, int);
-        goto process_precision;
-
-      case '.':
-        if (width < 0)
-          width = 0;
-        goto reswitch;
-
-      case '#':
-        altflag = 1;
-        goto reswitch;
-
-      process_precision:
-        if (width < 0)
-          width = precision, precision = -1;
-        goto reswitch;
-
-      // long flag (doubled for long long)
-      case 'l':
-        lflag++;
-        goto reswitch;
-
-      // character
-      case 'c':
-        putch(va_arg(aq, int), putdat);
-        break;
+toolong:
+  __atomic_store_n(&d->state, PRINTFMT_DYNAMIC, __ATOMIC_RELEASE);
+}
 
-      // error message
-      case 'i':
-        err = va_arg(aq, int);
-        if (err < 0)
-          err = -err;
-        if (err >= MAXERROR || (p = error_string[err]) == NULL)
-          printfmt(putch, putdat, "error %d", err);
-        else
-          printfmt(putch, putdat, "%s", p);
-        break;
+// Like vprintfmt_span() for d->fmt, but the format is parsed only on
+// the first call; later calls just run the stored pieces.
+void
+vprintfmt_desc(void (*write)(const char *, size_t, void *), void *ctx,
+               struct printfmt_desc *d, va_list ap) {
+  va_list aq;
+  int i;
 
-      // string
-      case 's':
-        if ((p = va_arg(aq, char *)) == NULL)
-          p = "(null)";
-        if (width > 0 && padc != '-')
-          for (width -= strnlen(p, precision); width > 0; width--)
-            putch(padc, putdat);
-        for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-          if (altflag && (ch < ' ' || ch > '~'))
-            putch('?', putdat);
-          else
-            putch(ch, putdat);
-        for (; width > 0; width--)
-          putch(' ', putdat);
-        break;
+  if (__atomic_load_n(&d->state, __ATOMIC_ACQUIRE) == PRINTFMT_NEW)
+    parse_desc(d);
+  if (d->state != PRINTFMT_PARSED) {
+    vprintfmt_span(write, ctx, d->fmt, ap);
+    return;
+  }
 
-      // (signed) decimal
-      case 'd':
-        num = getint(&aq, lflag);
-        if ((long long)num < 0) {
-          putch('-', putdat);
-          num = -(long long)num;
-        }
-        base = 10;
-        goto number;
-
-      // unsigned decimal
-      case 'u':
-        num  = getuint(&aq, lflag);
-        base = 10;
-        goto number;
-
-      // (unsigned) octal
-      case 'o':
-        num  = getuint(&aq, lflag);
-        base = 8;
-        goto number;
-
-      // pointer
-      case 'p':
-        putch('0', putdat);
-        putch('x', putdat);
-        num  = (unsigned long long)(uintptr_t)va_arg(aq, void *);
-        base = 16;
-        goto number;
-
-      // (unsigned) hexadecimal
-      case 'x':
-      case 'X':
-        num  = getuint(&aq, lflag);
-        base = 16;
-      number:
-        printnum(putch, putdat, num, base, width, padc);
-        break;
+  va_copy(aq, ap);
+  for (i = 0; i < d->nops; i++)
+    print_op_generic(write, ctx, &d->ops[i], &aq);
+  va_end(aq);
+}
 
-      // escaped '%' character
-      case '%':
-        putch(ch, putdat);
-        break;
+void
+printfmt_span(void (*write)(const char *, size_t, void *), void *ctx, const char *fmt, ...) {
+  va_list ap;
 
-      // unrecognized escape sequence - just print it literally
-      default:
-        putch('%', putdat);
-        for (fmt--; fmt[-1] != '%'; fmt--)
-          /* do nothing */;
-        break;
-    }
-  }
+  va_start(ap, fmt);
+  vprintfmt_span(write, ctx, fmt, ap);
+  va_end(ap);
+}
+
+// Adapter for character-at-a-time output functions.
+struct putchsink {
+  void (*putch)(int, void *);
+  void *putdat;
+};
+
+static void
+putchwrite(const char *s, size_t n, struct putchsink *sink) {
+  while (n-- > 0)
+    sink->putch(*s++, sink->putdat);
+}
+
+void
+vprintfmt(void (*putch)(int, void *), void *putdat, const char *fmt, va_list ap) {
+  struct putchsink sink = {putch, putdat};
+
+  vprintfmt_span((void *)putchwrite, &sink, fmt, ap);
 }
 
 void
@@ -254,22 +527,50 @@ struct sprintbuf {
   int cnt;
 };
 
-static void
-sprintputch(int ch, struct sprintbuf *b) {
-  b->cnt++;
-  if (b->buf < b->ebuf)
-    *b->buf++ = ch;
+// Copy a span straight into the buffer, truncating once per span.
+FMT_INLINE void
+sprintwrite(const char *s, size_t n, void *ctx) {
+  struct sprintbuf *b = ctx;
+  size_t room         = b->ebuf - b->buf;
+
+  b->cnt += n;
+  if (n > room)
+    n = room;
+  if (n <= 8) {
+    // most spans are a few characters; skip the memcpy call
+    while (n-- > 0)
+      *b->buf++ = *s++;
+  } else {
+    memcpy(b->buf, s, n);
+    b->buf += n;
+  }
 }
 
+// Same loop as vprintfmt_span(), but with its own copy of print_op()
+// in which every write is an inlined sprintwrite().
 int
 vsnprintf(char *buf, int n, const char *fmt, va_list ap) {
   struct sprintbuf b = {buf, buf + n - 1, 0};
+  const char *p;
+  struct fmtop op;
+  va_list aq;
 
   if (buf == NULL || n < 1)
     return -E_INVAL;
 
   // print the string to the buffer
-  vprintfmt((void *)sprintputch, &b, fmt, ap);
+  va_copy(aq, ap);
+  while (1) {
+    for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+      /* do nothing */;
+    if (fmt > p)
+      sprintwrite(p, fmt - p, &b);
+    if (*fmt++ == '\0')
+      break;
+    parse_op(&fmt, &op);
+    print_op(sprintwrite, &b, &op, &aq);
+  }
+  va_end(aq);
 
   // null terminate the buffer
   *b.buf = '\0';
@@ -0,0 +1,10 @@
+// Force-included when lib/printfmt.c is built for the host test,
+// so that its routines do not replace the C library's.
+
+#define printfmt       jos_printfmt
+#define vprintfmt      jos_vprintfmt
+#define printfmt_span  jos_printfmt_span
+#define vprintfmt_span jos_vprintfmt_span
+#define vprintfmt_desc jos_vprintfmt_desc
+#define snprintf       jos_snprintf
+#define vsnprintf      jos_vsnprintf
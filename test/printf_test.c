@@ -0,0 +1,191 @@
+// Native correctness test and benchmark for lib/printfmt.c.
+//
+// lib/printfmt.c is built for the host with its symbols renamed to
+// jos_*, like lib/string.c for string_test.  snprintf output and return
+// values are compared with the C library for the formats JOS supports,
+// with buffers large enough and truncating ones.  Then snprintf is timed
+// against a snprintf built on vprintfmt() that stores one character per
+// callback, which is how snprintf worked before it copied spans, and
+// against the C library.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int jos_snprintf(char *str, int size, const char *fmt, ...);
+int jos_vsnprintf(char *str, int size, const char *fmt, va_list ap);
+void jos_vprintfmt(void (*putch)(int, void *), void *putdat, const char *fmt, va_list ap);
+void jos_string_init(void);
+
+#define BUFSIZE      256
+#define BENCH_ROUNDS 2000000
+
+static int failures;
+
+#define FAIL(...)                     \
+  do {                                \
+    printf("printf_test: FAIL ");     \
+    printf(__VA_ARGS__);              \
+    printf("\n");                     \
+    if (++failures >= 10)             \
+      exit(1);                        \
+  } while (0)
+
+// Format with both implementations into buffers of every size from 1
+// to one more than needed and compare text and return value.
+static void
+check(const char *fmt, ...) {
+  char want[BUFSIZE], got[BUFSIZE];
+  int n, size, rw, rg;
+  va_list ap, aq;
+
+  va_start(ap, fmt);
+  va_copy(aq, ap);
+  n = vsnprintf(want, sizeof(want), fmt, aq);
+  va_end(aq);
+
+  for (size = 1; size <= n + 1 && size <= BUFSIZE; size++) {
+    memset(got, 0x7f, sizeof(got));
+    va_copy(aq, ap);
+    rg = jos_vsnprintf(got, size, fmt, aq);
+    va_end(aq);
+    va_copy(aq, ap);
+    rw = vsnprintf(want, size, fmt, aq);
+    va_end(aq);
+
+    if (rg != rw || strcmp(got, want) != 0)
+      FAIL("\"%s\" size %d: got %d \"%s\", want %d \"%s\"", fmt, size, rg, got, rw, want);
+    else if (size < BUFSIZE && got[size] != 0x7f)
+      FAIL("\"%s\" size %d: wrote past the buffer", fmt, size);
+  }
+  va_end(ap);
+}
+
+static void
+check_formats(void) {
+  check("");
+  check("plain text with no conversions");
+  check("%d %d %d %d", 0, 1, -1, 2147483647);
+  check("%d", -2147483647 - 1);
+  check("%ld %ld %lld", 9223372036854775807L, -9223372036854775807L - 1, -42LL);
+  check("%u %lu %llu", 4294967295u, 18446744073709551615UL, 12345ULL);
+  check("%x %lx %o %lo", 0xdeadbeefu, 0x123456789abcdefUL, 0755u, 01234567012345UL);
+  // Numbers take space or zero padding only, not '-', and a minus
+  // sign goes before the padding, so only positive ones are padded here.
+  check("%5d|%05d|%5u|%08x|%016lx", 42, 42, 7u, 0xbeefu, 0xcafeUL);
+  check("%*d|%0*x", 6, 3, 8, 0xabcu);
+  check("%s|%10s|%-10s|%.3s|%10.2s", "abc", "right", "left", "truncate", "xy");
+  check("%s and %s", "", "a somewhat longer string that is copied with memcpy");
+  check("%c%c%c %%", 'a', 'b', 'c');
+  check("pid %d: %s at %lx, %u bytes (%08x)\n", 1234, "kernel", 0x8041600000UL, 4096u, 0x1fu);
+}
+
+// The per-character snprintf the benchmark compares against.
+struct sprintbuf {
+  char *buf;
+  char *ebuf;
+  int cnt;
+};
+
+static void
+sprintputch(int ch, void *ctx) {
+  struct sprintbuf *b = ctx;
+
+  b->cnt++;
+  if (b->buf < b->ebuf)
+    *b->buf++ = ch;
+}
+
+static int
+putch_snprintf(char *buf, int n, const char *fmt, ...) {
+  struct sprintbuf b = {buf, buf + n - 1, 0};
+  va_list ap;
+
+  va_start(ap, fmt);
+  jos_vprintfmt(sprintputch, &b, fmt, ap);
+  va_end(ap);
+  *b.buf = '\0';
+  return b.cnt;
+}
+
+static const char *const bench_names[] = {"integers", "strings", "mixed"};
+#define NBENCH (sizeof(bench_names) / sizeof(bench_names[0]))
+
+// Called through a pointer so that the compiler cannot substitute
+// its own version of the C library snprintf.
+typedef int (*snprintf_fn)(char *, int, const char *, ...);
+
+static int
+libc_snprintf(char *buf, int n, const char *fmt, ...) {
+  va_list ap;
+  int rc;
+
+  va_start(ap, fmt);
+  rc = vsnprintf(buf, n, fmt, ap);
+  va_end(ap);
+  return rc;
+}
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns nanoseconds per call.
+static double
+bench_one(snprintf_fn f, int which) {
+  char buf[BUFSIZE];
+  volatile int sink = 0;
+  double t;
+  int i;
+
+  t = now();
+  for (i = 0; i < BENCH_ROUNDS; i++) {
+    switch (which) {
+    case 0:
+      sink += f(buf, sizeof(buf), "%d %u %x %ld %08x", i, i * 7u, i, (long)i << 20, i);
+      break;
+    case 1:
+      sink += f(buf, sizeof(buf), "%s: %s (%s)", "monitor", "unknown command", "type help");
+      break;
+    case 2:
+      sink += f(buf, sizeof(buf), "pid %d: %s at %lx, %u bytes (%08x)\n", i, "kernel",
+                0x8041600000UL + i, 4096u, i);
+      break;
+    }
+  }
+  t = now() - t;
+  (void)sink;
+  return t / BENCH_ROUNDS * 1e9;
+}
+
+static void
+bench(void) {
+  size_t w;
+
+  printf("printf_test: ns per snprintf call, spans / per character / libc\n");
+  for (w = 0; w < NBENCH; w++) {
+    double span = bench_one(jos_snprintf, w), putch = bench_one(putch_snprintf, w);
+
+    printf("%10s  %7.1f / %7.1f / %7.1f  (%.2fx)\n", bench_names[w], span, putch,
+           bench_one(libc_snprintf, w), putch / span);
+  }
+}
+
+int
+main(int argc, char **argv) {
+  jos_string_init();
+
+  check_formats();
+  if (failures)
+    return 1;
+  printf("printf_test: snprintf matches the C library\n");
+
+  bench();
+  return 0;
+}
@@ -0,0 +1,24 @@
+// Force-included when lib/string.c is built for the host test,
+// so that its routines do not replace the C library's.
+
+#define strlen        jos_strlen
+#define strnlen       jos_strnlen
+#define strcpy        jos_strcpy
+#define strncpy       jos_strncpy
+#define strcat        jos_strcat
+#define strlcpy       jos_strlcpy
+#define strlcat       jos_strlcat
+#define strcmp        jos_strcmp
+#define strncmp       jos_strncmp
+#define strchr        jos_strchr
+#define strfind       jos_strfind
+#define memset        jos_memset
+#define memcpy        jos_memcpy
+#define memmove       jos_memmove
+#define memcmp        jos_memcmp
+#define memfind       jos_memfind
+#define memset_nt     jos_memset_nt
+#define memcpy_nt     jos_memcpy_nt
+#define strtol        jos_strtol
+#define string_init   jos_string_init
+#define string_nt_min jos_string_nt_min
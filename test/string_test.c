@@ -0,0 +1,466 @@
+// Native correctness test and benchmark for lib/string.c.
+//
+// Built twice by test/Makefrag, against the ASM=1 and the ASM=0 build of
+// the library, whose symbols are renamed to jos_*.  Every routine is
+// compared with the C library for all sizes from 0 to MAXSIZE and all
+// source and destination alignments from 0 to MAXALIGN - 1.  Strings
+// are placed so that they end just before an unmapped page, which turns
+// any read past a page boundary into a fault.  Sizes around the size
+// where memset, memcpy and forward memmove switch to non-temporal
+// stores are checked separately, with the switch moved down to NT_MIN
+// to keep the buffers small, as are memset_nt and memcpy_nt
+// themselves.  Throughput of the jos and C library versions is then
+// printed side by side.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+int jos_strlen(const char *s);
+int jos_strnlen(const char *s, size_t size);
+int jos_strcmp(const char *s1, const char *s2);
+char *jos_strchr(const char *s, char c);
+char *jos_strfind(const char *s, char c);
+void *jos_memset(void *dst, int c, size_t len);
+void *jos_memcpy(void *dst, const void *src, size_t len);
+void *jos_memmove(void *dst, const void *src, size_t len);
+int jos_memcmp(const void *s1, const void *s2, size_t len);
+void *jos_memfind(const void *s, int c, size_t len);
+void *jos_memset_nt(void *dst, int c, size_t len);
+void *jos_memcpy_nt(void *dst, const void *src, size_t len);
+void jos_string_init(void);
+extern size_t jos_string_nt_min;
+
+#define MAXSIZE  4096
+#define MAXALIGN 64
+#define GUARD    32 // bytes checked on either side of a destination
+#define BUFSIZE  (MAXSIZE + 4 * MAXALIGN + 2 * GUARD)
+#define PAGESIZE 4096
+
+// Replaces the cache size based threshold during check_nt().
+#define NT_MIN     (512 * 1024)
+#define NT_MAXSIZE (NT_MIN + 4 * 1024)
+#define NT_BUFSIZE (NT_MAXSIZE + 2 * 4096 + 4 * MAXALIGN + 2 * GUARD)
+
+static const char *variant;
+static int failures;
+
+static uint8_t src[BUFSIZE], dst[BUFSIZE], ref[BUFSIZE];
+static const uint8_t zeros[GUARD];
+
+#define FAIL(...)                               \
+  do {                                          \
+    printf("string_test-%s: FAIL ", variant);   \
+    printf(__VA_ARGS__);                        \
+    printf("\n");                               \
+    if (++failures >= 10)                       \
+      exit(1);                                  \
+  } while (0)
+
+static int
+sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+static void
+fill_pattern(uint8_t *p, size_t n, unsigned seed) {
+  size_t i;
+
+  // Nonzero and different at every offset mod 251, so that misplaced
+  // bytes are caught and the buffers can double as strings.
+  for (i = 0; i < n; i++)
+    p[i] = 1 + (i * 7 + seed) % 251;
+}
+
+// Map 'size' bytes that end right before an inaccessible page.
+static uint8_t *
+alloc_guarded(size_t size) {
+  size_t len = (size + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
+  uint8_t *p = mmap(NULL, len + PAGESIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (p == MAP_FAILED || mprotect(p + len, PAGESIZE, PROT_NONE) < 0) {
+    perror("mmap");
+    exit(1);
+  }
+  return p + len - size;
+}
+
+static void
+check_memcpy(void) {
+  size_t n, sa, da;
+
+  fill_pattern(src, BUFSIZE, 0);
+  for (n = 0; n <= MAXSIZE; n++)
+    for (sa = 0; sa < MAXALIGN; sa++)
+      for (da = 0; da < MAXALIGN; da++) {
+        uint8_t *d = dst + GUARD + da;
+
+        memset(d - GUARD, 0, n + 2 * GUARD);
+        if (jos_memcpy(d, src + sa, n) != d)
+          FAIL("memcpy return value, size %zu", n);
+        if (memcmp(d, src + sa, n) != 0)
+          FAIL("memcpy size %zu src align %zu dst align %zu", n, sa, da);
+        if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+          FAIL("memcpy wrote outside, size %zu src align %zu dst align %zu", n, sa, da);
+      }
+}
+
+// Source and destination share one buffer, so most of these moves
+// overlap, in both directions and at every distance below MAXALIGN.
+static void
+check_memmove(void) {
+  size_t n, sa, da;
+
+  fill_pattern(src, BUFSIZE, 3);
+  for (n = 0; n <= MAXSIZE; n++)
+    for (sa = 0; sa < MAXALIGN; sa++)
+      for (da = 0; da < MAXALIGN; da++) {
+        size_t len = n + MAXALIGN + 2 * GUARD;
+
+        memcpy(dst, src, len);
+        memcpy(ref, src, len);
+        memmove(ref + GUARD + da, ref + GUARD + sa, n);
+        if (jos_memmove(dst + GUARD + da, dst + GUARD + sa, n) != dst + GUARD + da)
+          FAIL("memmove return value, size %zu", n);
+        if (memcmp(dst, ref, len) != 0)
+          FAIL("memmove size %zu src align %zu dst align %zu", n, sa, da);
+      }
+}
+
+static void
+check_memset(void) {
+  size_t n, da;
+
+  for (n = 0; n <= MAXSIZE; n++)
+    for (da = 0; da < MAXALIGN; da++) {
+      int c      = 0x80 | (n + da);
+      uint8_t *d = dst + GUARD + da;
+
+      memset(d - GUARD, 0, n + 2 * GUARD);
+      memset(ref, c, n);
+      if (jos_memset(d, c | 0x100, n) != d)
+        FAIL("memset return value, size %zu", n);
+      if (memcmp(d, ref, n) != 0)
+        FAIL("memset size %zu dst align %zu", n, da);
+      if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+        FAIL("memset wrote outside, size %zu dst align %zu", n, da);
+    }
+}
+
+// Strings of every length and alignment, ending less than MAXALIGN
+// bytes before an unmapped page.
+static void
+check_scan(void) {
+  size_t region = MAXSIZE + 2 * MAXALIGN;
+  char *end     = (char *)alloc_guarded(region) + region;
+  size_t n, sa;
+
+  for (n = 0; n <= MAXSIZE; n++)
+    for (sa = 0; sa < MAXALIGN; sa++) {
+      size_t off = ((uintptr_t)end - n - 1 - sa) % MAXALIGN;
+      char *s    = end - n - 1 - off;
+      char last, absent = (char)0xFF; // fill_pattern() never stores 0xFF
+      size_t lim;
+
+      fill_pattern((uint8_t *)s, n, sa);
+      s[n] = '\0';
+      last = n ? s[n - 1] : 'x';
+
+      if ((size_t)jos_strlen(s) != n)
+        FAIL("strlen size %zu align %zu", n, sa);
+      for (lim = n > 8 ? n - 8 : 0; lim <= n + 8; lim++)
+        if ((size_t)jos_strnlen(s, lim) != strnlen(s, lim))
+          FAIL("strnlen size %zu align %zu limit %zu", n, sa, lim);
+      if ((size_t)jos_strnlen(s, SIZE_MAX) != n)
+        FAIL("strnlen size %zu align %zu unlimited", n, sa);
+
+      if (jos_strchr(s, last) != strchr(s, last))
+        FAIL("strchr size %zu align %zu", n, sa);
+      if (jos_strchr(s, '\0') != NULL)
+        FAIL("strchr nul size %zu align %zu", n, sa);
+      if (jos_strfind(s, last) != strchr(s, last) && !(n == 0 && jos_strfind(s, last) == s))
+        FAIL("strfind size %zu align %zu", n, sa);
+      if (jos_strchr(s, absent) != NULL || jos_strfind(s, absent) != s + n)
+        FAIL("strchr/strfind absent size %zu align %zu", n, sa);
+
+      if (jos_memfind(s, last, n) != (memchr(s, last, n) ? memchr(s, last, n) : s + n))
+        FAIL("memfind size %zu align %zu", n, sa);
+      if (jos_memfind(s, absent, n) != s + n)
+        FAIL("memfind absent size %zu align %zu", n, sa);
+    }
+}
+
+// Compare strings at every pair of alignments.  The second string ends
+// in front of an unmapped page, which strcmp reads unaligned.
+static void
+check_compare(void) {
+  size_t region = MAXSIZE + 2 * MAXALIGN;
+  uint8_t *buf  = alloc_guarded(region);
+  size_t n, sa, da;
+
+  for (n = 0; n <= MAXSIZE; n++)
+    for (da = 0; da < MAXALIGN; da++) {
+      char *q = (char *)buf + region - n - 1 - da;
+
+      fill_pattern((uint8_t *)q, n, 0);
+      q[n] = '\0';
+      for (sa = 0; sa < MAXALIGN; sa++) {
+        char *p = (char *)src + sa;
+        size_t k = n ? (n * 31 + sa) % n : 0;
+
+        memcpy(p, q, n + 1);
+        if (jos_strcmp(p, q) != 0 || jos_memcmp(p, q, n) != 0)
+          FAIL("strcmp/memcmp equal size %zu aligns %zu %zu", n, sa, da);
+        if (n == 0)
+          continue;
+
+        // Differ at one position, in both directions.
+        p[k] += 0x40;
+        if (sign(jos_strcmp(p, q)) != sign(strcmp(p, q)) ||
+            sign(jos_strcmp(q, p)) != sign(strcmp(q, p)))
+          FAIL("strcmp size %zu aligns %zu %zu at %zu", n, sa, da, k);
+        if (sign(jos_memcmp(p, q, n)) != sign(memcmp(p, q, n)) ||
+            sign(jos_memcmp(q, p, n)) != sign(memcmp(q, p, n)))
+          FAIL("memcmp size %zu aligns %zu %zu at %zu", n, sa, da, k);
+
+        // One string is a prefix of the other.
+        p[k] = '\0';
+        if (sign(jos_strcmp(p, q)) != sign(strcmp(p, q)) ||
+            sign(jos_strcmp(q, p)) != sign(strcmp(q, p)))
+          FAIL("strcmp prefix size %zu aligns %zu %zu at %zu", n, sa, da, k);
+      }
+    }
+}
+
+static const size_t nt_sizes[] = {NT_MIN - 1, NT_MIN, NT_MIN + 1, NT_MIN + 15,
+                                   NT_MIN + 16, NT_MIN + 63, NT_MIN + 100, NT_MAXSIZE};
+static const size_t nt_aligns[] = {0, 1, 7, 8, 15, 16, 17, 31, 32, 63};
+static const size_t nt_distances[] = {1, 8, 15, 16, 17, 64, 100, 4096, 4099};
+#define NT_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// memset, memcpy and memmove at sizes around NT_MIN.  Overlapping
+// forward moves (destination below the source) also go through the
+// non-temporal copy; backward ones are checked for completeness.
+static void
+check_nt(void) {
+  uint8_t *bsrc = malloc(NT_BUFSIZE), *bdst = malloc(NT_BUFSIZE), *bref = malloc(NT_BUFSIZE);
+  size_t i, j, k, n, sa, da, dist, len;
+
+  if (!bsrc || !bdst || !bref) {
+    perror("malloc");
+    exit(1);
+  }
+  fill_pattern(bsrc, NT_BUFSIZE, 5);
+
+  for (i = 0; i < NT_COUNT(nt_sizes); i++) {
+    n = nt_sizes[i];
+    for (j = 0; j < NT_COUNT(nt_aligns); j++) {
+      uint8_t *d = bdst + GUARD + nt_aligns[j];
+      da         = nt_aligns[j];
+
+      memset(d - GUARD, 0, n + 2 * GUARD);
+      memset(bref, 0x80 | (int)da, n);
+      if (jos_memset(d, 0x80 | (int)da, n) != d || memcmp(d, bref, n) != 0)
+        FAIL("memset size %zu dst align %zu", n, da);
+      if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+        FAIL("memset wrote outside, size %zu dst align %zu", n, da);
+
+      for (k = 0; k < NT_COUNT(nt_aligns); k += 3) {
+        sa = nt_aligns[k];
+        memset(d - GUARD, 0, n + 2 * GUARD);
+        if (jos_memcpy(d, bsrc + sa, n) != d || memcmp(d, bsrc + sa, n) != 0)
+          FAIL("memcpy size %zu src align %zu dst align %zu", n, sa, da);
+        if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+          FAIL("memcpy wrote outside, size %zu src align %zu dst align %zu", n, sa, da);
+      }
+    }
+
+    for (k = 0; k < NT_COUNT(nt_distances); k++) {
+      dist = nt_distances[k];
+      len  = n + dist + 2 * GUARD + MAXALIGN;
+      for (j = 0; j < NT_COUNT(nt_aligns); j += 2) {
+        uint8_t *lo = bdst + GUARD + nt_aligns[j];
+        uint8_t *rlo = bref + GUARD + nt_aligns[j];
+
+        // Forward: destination below the source.
+        memcpy(bdst, bsrc, len);
+        memcpy(bref, bsrc, len);
+        memmove(rlo, rlo + dist, n);
+        if (jos_memmove(lo, lo + dist, n) != lo || memcmp(bdst, bref, len) != 0)
+          FAIL("memmove forward size %zu distance %zu align %zu", n, dist, nt_aligns[j]);
+
+        // Backward: destination above the source.
+        memcpy(bdst, bsrc, len);
+        memcpy(bref, bsrc, len);
+        memmove(rlo + dist, rlo, n);
+        if (jos_memmove(lo + dist, lo, n) != lo + dist || memcmp(bdst, bref, len) != 0)
+          FAIL("memmove backward size %zu distance %zu align %zu", n, dist, nt_aligns[j]);
+      }
+    }
+  }
+
+  // memset_nt and memcpy_nt handle the unaligned head and tail of any
+  // size themselves, and fall back to the plain routines below 64 bytes.
+  for (n = 0; n <= 512; n++)
+    for (da = 0; da < MAXALIGN; da++) {
+      uint8_t *d = bdst + GUARD + da;
+
+      memset(d - GUARD, 0, n + 2 * GUARD);
+      memset(bref, 0x81, n);
+      if (jos_memset_nt(d, 0x81, n) != d || memcmp(d, bref, n) != 0)
+        FAIL("memset_nt size %zu dst align %zu", n, da);
+      if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+        FAIL("memset_nt wrote outside, size %zu dst align %zu", n, da);
+
+      sa = (n + da) % MAXALIGN;
+      memset(d - GUARD, 0, n + 2 * GUARD);
+      if (jos_memcpy_nt(d, bsrc + sa, n) != d || memcmp(d, bsrc + sa, n) != 0)
+        FAIL("memcpy_nt size %zu src align %zu dst align %zu", n, sa, da);
+      if (memcmp(d - GUARD, zeros, GUARD) || memcmp(d + n, zeros, GUARD))
+        FAIL("memcpy_nt wrote outside, size %zu src align %zu dst align %zu", n, sa, da);
+    }
+
+  free(bsrc);
+  free(bdst);
+  free(bref);
+}
+
+// Benchmark
+
+static const size_t bench_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 8388608,
+};
+#define NBENCH_SIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+#define BENCH_BYTES  (256u << 20) // bytes processed per measurement
+
+enum { B_MEMCPY,
+       B_MEMMOVE,
+       B_MEMSET,
+       B_STRLEN,
+       B_MEMCMP,
+       NBENCH };
+static const char *const bench_names[NBENCH] = {"memcpy", "memmove", "memset", "strlen", "memcmp"};
+
+// Called through pointers so that the compiler cannot substitute
+// its own inline versions of the C library routines.
+struct impl {
+  void *(*memcpy)(void *, const void *, size_t);
+  void *(*memmove)(void *, const void *, size_t);
+  void *(*memset)(void *, int, size_t);
+  size_t (*strlen)(const char *);
+  int (*memcmp)(const void *, const void *, size_t);
+};
+
+static size_t
+jos_strlen_size(const char *s) {
+  return jos_strlen(s);
+}
+
+static const struct impl jos_impl  = {jos_memcpy, jos_memmove, jos_memset, jos_strlen_size, jos_memcmp};
+static const struct impl libc_impl = {memcpy, memmove, memset, strlen, memcmp};
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns GB/s for one routine at one size.
+static double
+bench_one(const struct impl *im, int which, uint8_t *a, uint8_t *b, size_t n) {
+  size_t reps = BENCH_BYTES / n, i;
+  volatile size_t sink = 0;
+  double t;
+
+  t = now();
+  for (i = 0; i < reps; i++) {
+    switch (which) {
+    case B_MEMCPY:
+      im->memcpy(b, a, n);
+      break;
+    case B_MEMMOVE:
+      im->memmove(a + 8, a, n);
+      break;
+    case B_MEMSET:
+      im->memset(b, (int)i, n);
+      break;
+    case B_STRLEN:
+      sink += im->strlen((const char *)a);
+      break;
+    case B_MEMCMP:
+      sink += im->memcmp(a, b, n);
+      break;
+    }
+  }
+  t = now() - t;
+  (void)sink;
+  return (double)reps * n / t / 1e9;
+}
+
+static void
+bench(void) {
+  size_t maxn = bench_sizes[NBENCH_SIZES - 1];
+  uint8_t *a  = malloc(maxn + 64), *b = malloc(maxn + 64);
+  size_t k;
+  int w;
+
+  if (!a || !b) {
+    perror("malloc");
+    exit(1);
+  }
+
+  printf("string_test-%s: throughput in GB/s, jos / libc\n", variant);
+  printf("%10s", "size");
+  for (w = 0; w < NBENCH; w++)
+    printf("  %15s", bench_names[w]);
+  printf("\n");
+
+  for (k = 0; k < NBENCH_SIZES; k++) {
+    size_t n = bench_sizes[k];
+
+    printf("%10zu", n);
+    for (w = 0; w < NBENCH; w++) {
+      // strlen and memcmp scan n bytes of equal, nonzero data.
+      memset(a, 'a', n + 8);
+      memset(b, 'a', n + 8);
+      a[n] = '\0';
+      printf("  %7.2f/%-7.2f", bench_one(&jos_impl, w, a, b, n), bench_one(&libc_impl, w, a, b, n));
+    }
+    printf("\n");
+  }
+
+  free(a);
+  free(b);
+}
+
+int
+main(int argc, char **argv) {
+  size_t nt_min;
+
+  variant = argc > 1 ? argv[1] : "?";
+  jos_string_init();
+
+  check_memcpy();
+  check_memmove();
+  check_memset();
+  check_scan();
+  check_compare();
+  nt_min            = jos_string_nt_min;
+  jos_string_nt_min = NT_MIN;
+  check_nt();
+  jos_string_nt_min = nt_min;
+  if (failures)
+    return 1;
+  printf("string_test-%s: all sizes 0-%d, alignments 0-%d OK\n", variant, MAXSIZE, MAXALIGN - 1);
+  printf("string_test-%s: sizes around %d (non-temporal) OK\n", variant, NT_MIN);
+  printf("string_test-%s: non-temporal stores from %zu bytes on\n", variant, nt_min);
+
+  bench();
+  return 0;
+}